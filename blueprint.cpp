@@ -1,9 +1,11 @@
 #include "blueprint.h"
 #include <zstd.h>
+#include <algorithm>
 #include <stdexcept>
 #include <QCryptographicHash>
 #include <QDebug>
 #include <QElapsedTimer>
+#include <QtConcurrent>
 
 using std::runtime_error;
 
@@ -58,31 +60,85 @@ const Blueprint::Ink Blueprint::Filler = QColor(140, 171, 161, 255);
 const Blueprint::Ink Blueprint::Empty = QColor(0, 0, 0, 0);
 const Blueprint::Ink Blueprint::Invalid = QColor();
 
-Blueprint::Blueprint (int width, int height, QObject *parent) :
-    QObject(parent)
+// layers smaller than this are always dense, there's little memory to save
+static const qint64 MinTiledArea = 256 * 256;
+// layers with at least this fraction of their tiles in use are stored dense
+static const double MaxTiledFill = 0.5;
+
+// empty pixels are all zero, the same as a cleared image
+static bool isEmptyRegion (const quint32 *pixels, int stride, int cols, int rows) {
+    for (int r = 0; r < rows; ++ r, pixels += stride)
+        if (std::any_of(pixels, pixels + cols, [] (quint32 p) { return p != 0; }))
+            return false;
+    return true;
+}
+
+// a tile with the given pixels in its top left corner, or a null image if they're empty
+static QImage makeTile (const quint32 *pixels, int stride, int cols, int rows) {
+    if (isEmptyRegion(pixels, stride, cols, rows))
+        return QImage();
+    QImage tile(Blueprint::TileSize, Blueprint::TileSize, QImage::Format_RGBA8888);
+    tile.fill(0);
+    for (int r = 0; r < rows; ++ r, pixels += stride)
+        std::copy(pixels, pixels + cols, (quint32 *)tile.scanLine(r));
+    return tile;
+}
+
+// index of the first non-empty pixel, or length if there isn't one. fixed size blocks
+// are or-ed together first, which the compiler vectorizes.
+static int firstInk (const quint32 *pixels, int length) {
+    int k = 0;
+    for (; k + 16 <= length; k += 16) {
+        quint32 any = 0;
+        for (int j = 0; j < 16; ++ j)
+            any |= pixels[k + j];
+        if (any)
+            break;
+    }
+    for (; k < length; ++ k)
+        if (pixels[k])
+            return k;
+    return length;
+}
+
+// index of the last non-empty pixel, or -1 if there isn't one
+static int lastInk (const quint32 *pixels, int length) {
+    int k = length;
+    for (; k - 16 >= 0; k -= 16) {
+        quint32 any = 0;
+        for (int j = 1; j <= 16; ++ j)
+            any |= pixels[k - j];
+        if (any)
+            break;
+    }
+    for (-- k; k >= 0; -- k)
+        if (pixels[k])
+            return k;
+    return -1;
+}
+
+Blueprint::Blueprint (int width, int height) :
+    width_(width),
+    height_(height)
 {
-    QImage bpImage(width, height, QImage::Format_RGBA8888);
-    bpImage.fill(0);
-    layers_[Logic] = bpImage.copy();
-    layers_[DecoOn] = bpImage.copy();
-    layers_[DecoOff] = bpImage.copy();
 }
 
-Blueprint::Blueprint (QImage bpImage, Layer layer, QObject *parent) :
-    QObject(parent)
+Blueprint::Blueprint (QImage bpImage, Layer layer) :
+    width_(bpImage.width()),
+    height_(bpImage.height())
 {
-    bpImage = bpImage.copy();
+    // converts in place if we hold the only reference, otherwise the conversion (or
+    // the first write) makes our own copy.
     bpImage.convertTo(QImage::Format_RGBA8888);
-    QImage emptyImage(bpImage.width(), bpImage.height(), QImage::Format_RGBA8888);
-    emptyImage.fill(0);
-    layers_[Logic] = (layer == Logic ? bpImage : emptyImage).copy();
-    layers_[DecoOn] = (layer == DecoOn ? bpImage : emptyImage).copy();
-    layers_[DecoOff] = (layer == DecoOff ? bpImage : emptyImage).copy();
+    Plane &plane = layers_[layer];
+    plane.image = std::move(bpImage);
+    chooseStorage(plane);
 }
 
-Blueprint::Blueprint (QString bpString, QObject *parent) :
-    QObject(parent),
-    bpString_(bpString)
+Blueprint::Blueprint (QString bpString) :
+    bpString_(bpString),
+    width_(0),
+    height_(0)
 {
 
     QElapsedTimer timer;
@@ -113,24 +169,27 @@ Blueprint::Blueprint (QString bpString, QObject *parent) :
     quint32 bpHeight = getInt(bp, 13, 4);
 
     //qDebug() << bpVersion << bpWidth << bpHeight;
+    width_ = bpWidth;
+    height_ = bpHeight;
+    bool foundLayer = false;
     int pos = 17;
     while (pos < bp.size()) {
         quint32 blockSize = getInt(bp, pos, 4);
         quint32 blockId = getInt(bp, pos + 4, 4);
         quint32 dataSize = getInt(bp, pos + 8, 4);
         //qDebug()  << "block" << blockSize << blockId << dataSize;
-        if (blockId == 0) {
-            QByteArray data(dataSize, 0);
-            size_t result = ZSTD_decompress(data.data(), data.size(), bp.data() + pos + 12, blockSize - 12);
-            if (result != dataSize)
-                throw runtime_error("Invalid blueprint string -- zstd decompress failed.");
-            QImage bpImage((const uchar *)data.constData(), bpWidth, bpHeight, QImage::Format_RGBA8888);
-            layers_[(Layer)blockId] = bpImage.copy();
+        if (blockSize < 12 || blockSize > (quint32)(bp.size() - pos))
+            throw runtime_error("Unexpected end of blueprint string.");
+        if (blockId <= DecoOff) {
+            if ((quint64)bpWidth * bpHeight * 4 != dataSize)
+                throw runtime_error("Invalid blueprint string -- layer size doesn't match.");
+            decodeLayer((Layer)blockId, bp.constData() + pos + 12, blockSize - 12);
+            foundLayer = true;
         }
         pos += blockSize;
     }
 
-    if (layers_.empty())
+    if (!foundLayer)
         throw runtime_error("Invalid blueprint string -- no layers found.");
 
     qint64 nsecs = timer.nsecsElapsed();
@@ -138,25 +197,421 @@ Blueprint::Blueprint (QString bpString, QObject *parent) :
 
 }
 
+void Blueprint::decodeLayer (Layer which, const char *data, size_t size) {
+
+    Plane &plane = layers_[which];
+    plane = Plane(); // a repeated block replaces the earlier one
+
+    // small layers decompress straight into a dense image
+    if ((qint64)width_ * height_ < MinTiledArea) {
+        plane.image = QImage(width_, height_, QImage::Format_RGBA8888);
+        if (plane.image.isNull() && width_ * height_ > 0)
+            throw runtime_error("Invalid blueprint string -- layer too large.");
+        const size_t expected = (size_t)width_ * height_ * 4;
+        if (ZSTD_decompress(plane.image.bits(), expected, data, size) != expected)
+            throw runtime_error("Invalid blueprint string -- zstd decompress failed.");
+        return;
+    }
+
+    // big ones a band of tiles at a time, keeping only the tiles in use, so a sparse
+    // layer never exists at full size. if most of the first band is in use the layer is
+    // taken to be dense and the rest goes straight into a dense image in one go.
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    ZSTD_inBuffer in = { data, size, 0 };
+    const auto decompress = [&] (void *pixels, size_t bytes) {
+        ZSTD_outBuffer out = { pixels, bytes, 0 };
+        bool ok = true;
+        while (ok && out.pos < out.size) {
+            const size_t inPos = in.pos, outPos = out.pos;
+            const size_t result = ZSTD_decompressStream(dctx, &out, &in);
+            ok = !ZSTD_isError(result) && (in.pos != inPos || out.pos != outPos);
+        }
+        return ok;
+    };
+
+    plane.tiled = true;
+    plane.tiles = QVector<QImage>(tilesX() * tilesY());
+    QVector<quint32> band(TileSize * width_);
+    bool ok = true;
+    for (int ty = 0; ty < tilesY() && ok; ++ ty) {
+        const int rows = std::min(TileSize, height_ - ty * TileSize);
+        if (!(ok = decompress(band.data(), (size_t)rows * width_ * 4)))
+            break;
+        int used = 0;
+        for (int tx = 0; tx < tilesX(); ++ tx) {
+            const int cols = std::min(TileSize, width_ - tx * TileSize);
+            QImage &tile = plane.tiles[ty * tilesX() + tx];
+            tile = makeTile(band.constData() + tx * TileSize, width_, cols, rows);
+            used += !tile.isNull();
+        }
+        if (ty == 0 && used > tilesX() * MaxTiledFill) {
+            plane.tiles.clear();
+            plane.tiled = false;
+            plane.image = QImage(width_, height_, QImage::Format_RGBA8888);
+            if (plane.image.isNull()) {
+                ZSTD_freeDCtx(dctx);
+                throw runtime_error("Invalid blueprint string -- layer too large.");
+            }
+            std::copy(band.constBegin(), band.constBegin() + rows * width_, (quint32 *)plane.image.bits());
+            if (height_ > rows)
+                ok = decompress(plane.image.scanLine(rows), (size_t)(height_ - rows) * width_ * 4);
+            break;
+        }
+    }
+    ZSTD_freeDCtx(dctx);
+    if (!ok)
+        throw runtime_error("Invalid blueprint string -- zstd decompress failed.");
+
+    chooseStorage(plane);
+
+}
+
+void Blueprint::optimizeStorage () {
+
+    for (Plane &plane : layers_)
+        chooseStorage(plane);
+
+}
+
+void Blueprint::chooseStorage (Plane &plane) const {
+
+    if (!plane.tiled && (plane.image.isNull() || (qint64)width_ * height_ < MinTiledArea))
+        return;
+
+    const int count = tilesX() * tilesY();
+    int used = 0;
+    if (plane.tiled) {
+        for (const QImage &tile : plane.tiles)
+            used += !tile.isNull();
+    } else {
+        const int stride = plane.image.bytesPerLine() / 4;
+        for (int ty = 0; ty < tilesY(); ++ ty) {
+            for (int tx = 0; tx < tilesX(); ++ tx) {
+                const quint32 *pixels = (const quint32 *)plane.image.constScanLine(ty * TileSize) + tx * TileSize;
+                used += !isEmptyRegion(pixels, stride, std::min(TileSize, width_ - tx * TileSize), std::min(TileSize, height_ - ty * TileSize));
+            }
+        }
+    }
+
+    const bool tiled = ((qint64)width_ * height_ >= MinTiledArea && used < count * MaxTiledFill);
+    if (tiled == plane.tiled)
+        return;
+
+    if (tiled) {
+        const int stride = plane.image.bytesPerLine() / 4;
+        QVector<QImage> tiles(count);
+        for (int ty = 0; ty < tilesY(); ++ ty) {
+            for (int tx = 0; tx < tilesX(); ++ tx) {
+                const quint32 *pixels = (const quint32 *)plane.image.constScanLine(ty * TileSize) + tx * TileSize;
+                tiles[ty * tilesX() + tx] = makeTile(pixels, stride, std::min(TileSize, width_ - tx * TileSize), std::min(TileSize, height_ - ty * TileSize));
+            }
+        }
+        plane.tiles = tiles;
+        plane.image = QImage();
+        plane.tiled = true;
+    } else {
+        plane.image = toImage(plane);
+        plane.tiles.clear();
+        plane.tiled = false;
+    }
+
+}
+
+QImage Blueprint::toImage (const Plane &plane) const {
+
+    if (!plane.tiled && !plane.image.isNull())
+        return plane.image;
+
+    QImage image(width_, height_, QImage::Format_RGBA8888);
+    image.fill(0);
+    if (plane.tiled) {
+        for (int ty = 0; ty < tilesY(); ++ ty) {
+            for (int tx = 0; tx < tilesX(); ++ tx) {
+                const QImage &tile = plane.tiles[ty * tilesX() + tx];
+                if (tile.isNull())
+                    continue;
+                const int cols = std::min(TileSize, width_ - tx * TileSize);
+                const int rows = std::min(TileSize, height_ - ty * TileSize);
+                for (int r = 0; r < rows; ++ r) {
+                    const quint32 *in = (const quint32 *)tile.constScanLine(r);
+                    std::copy(in, in + cols, (quint32 *)image.scanLine(ty * TileSize + r) + tx * TileSize);
+                }
+            }
+        }
+    }
+    return image;
+
+}
+
+QImage Blueprint::layer (Layer which) const {
+
+    return toImage(layers_.value(which));
+
+}
+
+bool Blueprint::isLayerEmpty (Layer which) const {
+
+    const auto plane = layers_.constFind(which);
+    if (plane == layers_.constEnd())
+        return true;
+    else if (!plane->tiled)
+        return plane->image.isNull();
+    else
+        return std::all_of(plane->tiles.begin(), plane->tiles.end(), [] (const QImage &tile) { return tile.isNull(); });
+
+}
+
+bool Blueprint::isLayerTiled (Layer which) const {
+
+    return layers_.value(which).tiled;
+
+}
+
+QImage & Blueprint::denseLayer (Layer which) {
+
+    Plane &plane = layers_[which];
+    if (plane.tiled || plane.image.isNull()) {
+        plane.image = toImage(plane);
+        plane.tiles.clear();
+        plane.tiled = false;
+    }
+    return plane.image;
+
+}
+
+quint32 * Blueprint::writableSpan (Layer which, int x, int y, int *length) {
+
+    Plane &plane = layers_[which];
+    if (!plane.tiled && plane.image.isNull() && (qint64)width_ * height_ >= MinTiledArea) {
+        // big layers start out tiled, so sparse writes stay small
+        plane.tiles = QVector<QImage>(tilesX() * tilesY());
+        plane.tiled = true;
+    }
+
+    if (!plane.tiled) {
+        *length = width_ - x;
+        return (quint32 *)denseLayer(which).scanLine(y) + x;
+    }
+
+    QImage &tile = plane.tiles[(y / TileSize) * tilesX() + x / TileSize];
+    if (tile.isNull()) {
+        tile = QImage(TileSize, TileSize, QImage::Format_RGBA8888);
+        tile.fill(0);
+    }
+    *length = std::min(TileSize - x % TileSize, width_ - x);
+    return (quint32 *)tile.scanLine(y % TileSize) + x % TileSize;
+
+}
+
+const quint32 * Blueprint::span (const Plane &plane, int width, int x, int y, int *length) {
+
+    if (!plane.tiled) {
+        *length = width - x;
+        return plane.image.isNull() ? nullptr : (const quint32 *)plane.image.constScanLine(y) + x;
+    }
+
+    const int across = (width + TileSize - 1) / TileSize;
+    const QImage *row = plane.tiles.constData() + (y / TileSize) * across;
+    int tx = x / TileSize;
+    *length = std::min(TileSize - x % TileSize, width - x);
+    if (!row[tx].isNull())
+        return (const quint32 *)row[tx].constScanLine(y % TileSize) + x % TileSize;
+
+    // empty, and so are any empty tiles after it
+    while (++ tx < across && row[tx].isNull())
+        *length = std::min(width, (tx + 1) * TileSize) - x;
+    return nullptr;
+
+}
+
+const quint32 * Blueprint::constSpan (Layer which, int x, int y, int *length) const {
+
+    const auto plane = layers_.constFind(which);
+    if (plane == layers_.constEnd()) {
+        *length = width_ - x;
+        return nullptr;
+    }
+    return span(*plane, width_, x, y, length);
+
+}
+
 void Blueprint::setPixel (Layer which, int x, int y, Ink ink) {
 
     bpString_ = ""; // invalidate current blueprint string
 
-    QImage &image = layers_[which];
-    if (x < 0 || y < 0 || x >= image.width() || y >= image.height())
+    if (x < 0 || y < 0 || x >= width_ || y >= height_)
         throw runtime_error("Coordinates out of range for layer.");
 
-    image.setPixelColor(x, y, ink);
+    if (ink.isValid()) {
+        int length;
+        *writableSpan(which, x, y, &length) = RawInk(ink);
+    }
+
+}
+
+quint32 * Blueprint::scanLine (Layer which, int y) {
+
+    bpString_ = ""; // invalidate current blueprint string
+
+    return (quint32 *)denseLayer(which).scanLine(y);
+
+}
+
+void Blueprint::fillRect (Layer which, const QRect &rect, Ink ink) {
+
+    const QRect area = rect.intersected(QRect(0, 0, width_, height_));
+    if (area.isEmpty() || !ink.isValid())
+        return;
+
+    bpString_ = ""; // invalidate current blueprint string
+
+    const quint32 raw = RawInk(ink);
+    for (int y = area.top(); y <= area.bottom(); ++ y) {
+        for (int x = area.left(); x <= area.right(); ) {
+            int length;
+            if (ink == Empty && !constSpan(which, x, y, &length)) {
+                x += length; // already empty, don't allocate it
+                continue;
+            }
+            quint32 *out = writableSpan(which, x, y, &length);
+            length = std::min(length, area.right() + 1 - x);
+            std::fill(out, out + length, raw);
+            x += length;
+        }
+    }
+
+}
+
+void Blueprint::blit (const Blueprint &source, const QRect &sourceRect, int x, int y, Layers layers, bool skipEmpty) {
+
+    // clip to the source, then to the destination, and map back
+    const QPoint offset(x - sourceRect.x(), y - sourceRect.y());
+    const QRect to = sourceRect.intersected(QRect(0, 0, source.width_, source.height_))
+            .translated(offset).intersected(QRect(0, 0, width_, height_));
+    if (to.isEmpty())
+        return;
+    const QRect from = to.translated(-offset);
+
+    bpString_ = ""; // invalidate current blueprint string
+
+    for (Layer layer : { Logic, DecoOn, DecoOff }) {
+        if (!layers.testFlag((LayerFlag)(1 << layer)))
+            continue;
+        // a shallow copy: if source is this blueprint, writing below detaches our layer
+        // from it, so overlapping regions read the original pixels.
+        const Plane src = source.layers_.value(layer);
+        for (int row = 0; row < to.height(); ++ row) {
+            for (int k = 0; k < to.width(); ) {
+                int length;
+                const quint32 *in = span(src, source.width_, from.left() + k, from.top() + row, &length);
+                length = std::min(length, to.width() - k);
+                if (!in) {
+                    if (!skipEmpty)
+                        fillRect(layer, QRect(to.left() + k, to.top() + row, length, 1), Empty);
+                    k += length;
+                    continue;
+                }
+                for (int done = 0; done < length; ) {
+                    int room;
+                    quint32 *out = writableSpan(layer, to.left() + k + done, to.top() + row, &room);
+                    room = std::min(room, length - done);
+                    if (!skipEmpty) {
+                        std::copy(in + done, in + done + room, out);
+                    } else {
+                        for (int p = 0; p < room; ++ p)
+                            if (in[done + p] != 0)
+                                out[p] = in[done + p];
+                    }
+                    done += room;
+                }
+                k += length;
+            }
+        }
+    }
+
+}
+
+QRect Blueprint::contentBounds () const {
+
+    int left = width_, right = -1, top = height_, bottom = -1;
+
+    for (const Plane &plane : layers_) {
+        for (int y = 0; y < height_; ++ y) {
+            for (int x = 0; x < width_; ) {
+                int length;
+                const quint32 *pixels = span(plane, width_, x, y, &length);
+                if (pixels) {
+                    const int first = firstInk(pixels, length);
+                    if (first < length) {
+                        left = std::min(left, x + first);
+                        right = std::max(right, x + lastInk(pixels, length));
+                        top = std::min(top, y);
+                        bottom = std::max(bottom, y);
+                    }
+                }
+                x += length;
+            }
+        }
+    }
+
+    return right < 0 ? QRect() : QRect(QPoint(left, top), QPoint(right, bottom));
+
+}
+
+Blueprint Blueprint::cropped (const QRect &rect) const {
+
+    Blueprint result(std::max(0, rect.width()), std::max(0, rect.height()));
+    result.blit(*this, rect, 0, 0);
+    result.optimizeStorage();
+    return result;
+
+}
+
+Blueprint Blueprint::trimmed () const {
+
+    const QRect bounds = contentBounds();
+    if (bounds.isEmpty() || bounds == QRect(0, 0, width_, height_))
+        return *this;
+    else
+        return cropped(bounds);
+
+}
+
+quint32 Blueprint::RawInk (Ink ink) {
+
+    // RGBA8888 is byte ordered, regardless of endianness
+    quint32 raw;
+    uchar *bytes = (uchar *)&raw;
+    bytes[0] = ink.red();
+    bytes[1] = ink.green();
+    bytes[2] = ink.blue();
+    bytes[3] = ink.alpha();
+    return raw;
+
+}
+
+Blueprint::Ink Blueprint::InkFromRaw (quint32 raw) {
+
+    const uchar *bytes = (const uchar *)&raw;
+    return QColor(bytes[0], bytes[1], bytes[2], bytes[3]);
 
 }
 
 Blueprint::Ink Blueprint::getPixel (Layer which, int x, int y) const {
 
-    const QImage &image = layers_[which];
-    if (x < 0 || y < 0 || x >= image.width() || y >= image.height())
+    if (x < 0 || y < 0 || x >= width_ || y >= height_)
         throw runtime_error("Coordinates out of range for layer.");
 
-    return image.pixelColor(x, y);
+    const auto plane = layers_.constFind(which);
+    if (plane == layers_.constEnd())
+        return Empty;
+    const QImage &image = (plane->tiled ? plane->tiles[(y / TileSize) * tilesX() + x / TileSize] : plane->image);
+    if (image.isNull())
+        return Empty;
+    else if (plane->tiled)
+        return InkFromRaw(((const quint32 *)image.constScanLine(y % TileSize))[x % TileSize]);
+    else
+        return InkFromRaw(((const quint32 *)image.constScanLine(y))[x]);
 
 }
 
@@ -180,22 +635,28 @@ void Blueprint::generateBlueprintString () const {
         raw.append((value >> 0) & 255);
     };
 
-    quint32 width = layers_[Logic].width();
-    quint32 height = layers_[Logic].height();
+    quint32 width = width_;
+    quint32 height = height_;
     appendInt4(width);
     appendInt4(height);
 
-    for (Layer layer : { Logic, DecoOn, DecoOff }) {
-        QImage image = layers_[layer];
-        quint32 uncompressedSize = image.width() * image.height() * 4;
-        QByteArray compressedData(uncompressedSize * 2 + 100, 0);
-        compressedData.detach();
-        quint32 compressedSize = (quint32)ZSTD_compress(compressedData.data(), compressedData.size(), image.constBits(), uncompressedSize, 22);
-        quint32 blockSize = 12 + compressedSize;
+    // layers compress independently, so in parallel
+    QVector<int> layers = { Logic, DecoOn, DecoOff };
+    QVector<QByteArray> compressed(layers.size());
+    QtConcurrent::blockingMap(layers, [&] (int &layer) {
+        compressed[layer] = compressLayer((Layer)layer);
+    });
+    for (const QByteArray &data : compressed)
+        if (data.isNull())
+            throw runtime_error("Failed to encode blueprint -- zstd compress failed.");
+
+    for (int layer : layers) {
+        quint32 uncompressedSize = width * height * 4;
+        quint32 blockSize = 12 + compressed[layer].size();
         appendInt4(blockSize);
         appendInt4((quint32)layer);
         appendInt4(uncompressedSize);
-        raw.append(compressedData.constData(), compressedSize);
+        raw.append(compressed[layer]);
     }
 
     QByteArray rawBase64 = raw.toBase64();
@@ -207,6 +668,56 @@ void Blueprint::generateBlueprintString () const {
 
 }
 
+QByteArray Blueprint::compressLayer (Layer layer) const {
+
+    const Plane plane = layers_.value(layer);
+    const size_t uncompressedSize = (size_t)width_ * height_ * 4;
+    QByteArray compressedData(ZSTD_compressBound(uncompressedSize), Qt::Uninitialized);
+    size_t compressedSize;
+    if (!plane.tiled && !plane.image.isNull()) {
+        compressedSize = ZSTD_compress(compressedData.data(), compressedData.size(), plane.image.constBits(), uncompressedSize, 22);
+    } else {
+        // never written, or tiled: stream a band of tile rows at a time instead of
+        // putting the whole layer together. empty tiles are zeros.
+        QVector<quint32> band(TileSize * width_, 0);
+        ZSTD_CCtx *cctx = ZSTD_createCCtx();
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, 22);
+        ZSTD_CCtx_setPledgedSrcSize(cctx, uncompressedSize);
+        ZSTD_outBuffer out = { compressedData.data(), (size_t)compressedData.size(), 0 };
+        size_t left = 0;
+        for (int top = 0; ; top += TileSize) {
+            const int rows = std::max(0, std::min(TileSize, height_ - top));
+            if (plane.tiled) {
+                std::fill(band.begin(), band.end(), 0);
+                for (int tx = 0; tx < tilesX(); ++ tx) {
+                    const QImage &tile = plane.tiles[(top / TileSize) * tilesX() + tx];
+                    if (tile.isNull())
+                        continue;
+                    const int cols = std::min(TileSize, width_ - tx * TileSize);
+                    for (int r = 0; r < rows; ++ r) {
+                        const quint32 *in = (const quint32 *)tile.constScanLine(r);
+                        std::copy(in, in + cols, band.data() + r * width_ + tx * TileSize);
+                    }
+                }
+            }
+            ZSTD_inBuffer in = { band.constData(), (size_t)rows * width_ * 4, 0 };
+            const ZSTD_EndDirective mode = (top + TileSize >= height_ ? ZSTD_e_end : ZSTD_e_continue);
+            do {
+                left = ZSTD_compressStream2(cctx, &out, &in, mode);
+            } while (!ZSTD_isError(left) && (mode == ZSTD_e_end ? left != 0 : in.pos < in.size));
+            if (ZSTD_isError(left) || mode == ZSTD_e_end)
+                break;
+        }
+        ZSTD_freeCCtx(cctx);
+        compressedSize = (ZSTD_isError(left) ? left : out.pos);
+    }
+    if (ZSTD_isError(compressedSize))
+        return QByteArray(); // null
+    compressedData.resize((int)compressedSize);
+    return compressedData;
+
+}
+
 
 QString Blueprint::toDiscordEmoji () const {
 
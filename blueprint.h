@@ -1,13 +1,20 @@
 #ifndef BLUEPRINT_H
 #define BLUEPRINT_H
 
-#include <QObject>
 #include <QColor>
 #include <QImage>
 #include <QMap>
+#include <QRect>
+#include <QVector>
 
-class Blueprint : public QObject {
-    Q_OBJECT
+// a value type: copies are cheap, since the layers are implicitly shared and only
+// detached when one of the copies is written to, and moves are cheaper still.
+//
+// thread safety: different Blueprint objects can be used from different threads at
+// the same time, even copies of each other. one object can be read from several
+// threads at once through its const functions (FindOverlaps() relies on that), except
+// bpString(), which caches its result. anything else needs locking.
+class Blueprint {
 public:
     using Ink = QColor;
     static const Ink Cross;
@@ -65,25 +72,92 @@ public:
         DecoOn = 1,
         DecoOff = 2
     };
-    explicit Blueprint (QString bpString, QObject *parent = nullptr);
-    Blueprint (QImage bpImage, Layer layer, QObject *parent = nullptr);
-    Blueprint (int width, int height, QObject *parent = nullptr);
-    QImage layer (Layer which) const { return layers_[which]; }
+    enum LayerFlag {
+        LogicLayer = 1 << Logic,
+        DecoOnLayer = 1 << DecoOn,
+        DecoOffLayer = 1 << DecoOff,
+        AllLayers = LogicLayer | DecoOnLayer | DecoOffLayer
+    };
+    Q_DECLARE_FLAGS(Layers, LayerFlag)
+    // a null blueprint, 0x0
+    Blueprint () : width_(0), height_(0) { }
+    explicit Blueprint (QString bpString);
+    // takes over bpImage's pixels (pass it with std::move to avoid a copy if it's already
+    // RGBA8888); the other layers start empty.
+    Blueprint (QImage bpImage, Layer layer);
+    Blueprint (int width, int height);
+    bool isNull () const { return width_ <= 0 || height_ <= 0; }
+    // layers are null until first written. after that big layers that are mostly empty
+    // are kept as TileSize square tiles, with empty tiles taking no memory, and the rest
+    // as one image. the choice is automatic, see optimizeStorage().
+    static constexpr int TileSize = 64;
+    QImage layer (Layer which) const;
+    bool isLayerEmpty (Layer which) const;
+    bool isLayerTiled (Layer which) const;
+    // picks tiled or dense storage for every layer by how many tiles are in use. already
+    // done for blueprints read from strings or images; scanLine() makes a layer dense.
+    void optimizeStorage ();
     void setPixel (Layer which, int x, int y, Ink ink);
     void set (int x, int y, Ink ink) { setPixel(Logic, x, y, ink); }
     QString bpString () const;
-    int width () const { return layers_.first().width(); }
-    int height () const { return layers_.first().height(); }
+    int width () const { return width_; }
+    int height () const { return height_; }
     Ink getPixel (Layer which, int x, int y) const;
     Ink get (int x, int y) const { return getPixel(Logic, x, y); }
+    // bulk writes. regions are clipped to the blueprint, and the blueprint string is only
+    // invalidated once per call. invalid inks are ignored, like setPixel().
+    void fillRect (Layer which, const QRect &rect, Ink ink);
+    void fillRect (const QRect &rect, Ink ink) { fillRect(Logic, rect, ink); }
+    void hline (Layer which, int x, int y, int length, Ink ink) { fillRect(which, QRect(x, y, length, 1), ink); }
+    void vline (Layer which, int x, int y, int length, Ink ink) { fillRect(which, QRect(x, y, 1, length), ink); }
+    // copies sourceRect of source (which may be this blueprint, overlapping is fine) to
+    // x, y on the given layers. with skipEmpty, empty source pixels leave the destination
+    // as it is.
+    void blit (const Blueprint &source, const QRect &sourceRect, int x, int y, Layers layers = AllLayers, bool skipEmpty = false);
+    // the smallest rectangle holding every non-empty pixel on any layer; empty if there
+    // are none.
+    QRect contentBounds () const;
+    // a copy of rect; parts of it outside the blueprint are empty.
+    Blueprint cropped (const QRect &rect) const;
+    // cropped to contentBounds(), or an unchanged copy if there's no ink at all.
+    Blueprint trimmed () const;
+    // raw pixel access for bulk writers. pixels are RGBA8888, use RawInk() for the value
+    // of an ink. invalidates the blueprint string and makes the layer dense; no bounds
+    // checks.
+    quint32 * scanLine (Layer which, int y);
+    // raw pixel access for readers: the pixels from x, y to the end of the row or tile,
+    // with their count in *length. nullptr if they're all empty, then *length may span
+    // several empty tiles. no bounds checks.
+    const quint32 * constSpan (Layer which, int x, int y, int *length) const;
+    static quint32 RawInk (Ink ink);
+    static Ink InkFromRaw (quint32 raw);
     // utilities
     QString toDiscordEmoji () const;
 private:
+    struct Plane {
+        QImage image;           // dense pixels, or
+        QVector<QImage> tiles;  // tiles, row major, if tiled; empty tiles are null
+        bool tiled;
+        Plane () : tiled(false) { }
+    };
     mutable QString bpString_;
-    QMap<Layer,QImage> layers_;
+    int width_;
+    int height_;
+    QMap<Layer,Plane> layers_; // layers never written to are missing, and take no memory
+    int tilesX () const { return (width_ + TileSize - 1) / TileSize; }
+    int tilesY () const { return (height_ + TileSize - 1) / TileSize; }
+    void decodeLayer (Layer which, const char *data, size_t size);
+    void chooseStorage (Plane &plane) const;
+    QImage toImage (const Plane &plane) const;
+    QImage & denseLayer (Layer which);
+    quint32 * writableSpan (Layer which, int x, int y, int *length);
+    static const quint32 * span (const Plane &plane, int width, int x, int y, int *length);
     void generateBlueprintString () const;
+    QByteArray compressLayer (Layer layer) const;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(Blueprint::Layers)
+
 inline bool operator < (const Blueprint::Ink &a, const Blueprint::Ink &b) {
     if (a.red() != b.red())
         return a.red() < b.red();
@@ -1,14 +1,22 @@
 #include "circuits.h"
+#include "compiler.h"
 #include <QFont>
 #include <QPainter>
+#include <QTextBoundaryFinder>
 #include <QDebug>
+#include <QtConcurrent>
+#include <QtAlgorithms>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
 #include <stdexcept>
 
 using std::runtime_error;
 
 namespace Circuits {
 
-Blueprint * ROM (int addressBits, int dataBits, ROMDataLSBSide dataLSB, ROMAddress0Side addr0Side, const QVector<quint64> &data, bool omitEmpty) {
+Blueprint ROM (int addressBits, int dataBits, ROMDataLSBSide dataLSB, ROMAddress0Side addr0Side, const QVector<quint64> &data, bool omitEmpty) {
 
     const Blueprint::Ink trace = Blueprint::Trace5;
 
@@ -18,175 +26,1868 @@ Blueprint * ROM (int addressBits, int dataBits, ROMDataLSBSide dataLSB, ROMAddre
     // things will go nuts if bit counts are too high but for now just let
     // things go nuts. maybe overflow checking some day.
     quint64 addresses = 1ULL << addressBits;
-    int width = 3 + 2 * addresses + 1;
+
+    // one column per address up to the last nonzero one, or per nonzero address if
+    // omitting empty ones. every column decodes its full address, so addresses past the
+    // end match no column and read as zero. the width is the final width, nothing gets
+    // trimmed afterwards.
+    QVector<quint64> used;
+    quint64 end = 0;
+    for (quint64 address = 0; address < addresses && address < (quint64)data.size(); ++ address) {
+        if (data[address] != 0) {
+            if (omitEmpty)
+                used.append(address);
+            end = address + 1;
+        }
+    }
+    // without omitEmpty, bit 0 has a single line and relies on columns alternating
+    // and/nor with address parity, which only holds from the far side if the column
+    // count is even.
+    if (end % 2)
+        ++ end;
+    const quint64 columns = (omitEmpty ? used.size() : end);
+    const auto columnAddress = [&] (quint64 k) { return omitEmpty ? used[k] : k; };
+
+    int width = 3 + 2 * columns + 1;
     int height = (omitEmpty ? 3 : 1) + 4 * (addressBits - 1) + 2 * dataBits;
     qDebug() << "rom will be" << width << "x" << height;
 
-    Blueprint *bp = new Blueprint(width, height);
-    int row, col;
+    Blueprint bp(width, height);
+    int row;
 
     // address inputs
     row = height - 1;
     for (int a = 0; a < addressBits; ++ a) {
         if (a == 0) {
             if (omitEmpty) {
-                bp->set(1, row-2, Blueprint::Not);
-                bp->set(2, row-2, Blueprint::Write);
-                bp->set(0, row-1, trace);
-                bp->set(1, row-1, Blueprint::Read);
-                bp->set(1, row, Blueprint::Buffer);
-                bp->set(2, row, Blueprint::Write);
+                bp.set(1, row-2, Blueprint::Not);
+                bp.set(2, row-2, Blueprint::Write);
+                bp.set(0, row-1, trace);
+                bp.set(1, row-1, Blueprint::Read);
+                bp.set(1, row, Blueprint::Buffer);
+                bp.set(2, row, Blueprint::Write);
                 row -= 3;
             } else {
-                bp->set(0, row, Blueprint::Read);
-                bp->set(1, row, addr0Side == Far ? Blueprint::Buffer : Blueprint::Not);
-                bp->set(2, row, Blueprint::Write);
+                bp.set(0, row, Blueprint::Read);
+                bp.set(1, row, addr0Side == Far ? Blueprint::Buffer : Blueprint::Not);
+                bp.set(2, row, Blueprint::Write);
                 row -= 1;
             }
         } else {
-            bp->set(1, row-3, Blueprint::Not);
-            bp->set(2, row-3, Blueprint::Write);
-            bp->set(0, row-2, trace);
-            bp->set(1, row-2, Blueprint::Read);
-            bp->set(1, row-1, Blueprint::Buffer);
-            bp->set(2, row-1, Blueprint::Write);
+            bp.set(1, row-3, Blueprint::Not);
+            bp.set(2, row-3, Blueprint::Write);
+            bp.set(0, row-2, trace);
+            bp.set(1, row-2, Blueprint::Read);
+            bp.set(1, row-1, Blueprint::Buffer);
+            bp.set(2, row-1, Blueprint::Write);
             row -= 4;
         }
     }
 
+    // outputs
+    for (int bit = 0; bit < dataBits; ++ bit)
+        bp.set(width - 1, bit * 2, trace);
+
+    // the crossbar is written straight into the logic layer, in independent column
+    // ranges so it can be split across threads.
+    QVector<quint32 *> lines(height);
+    for (row = 0; row < height; ++ row)
+        lines[row] = bp.scanLine(Blueprint::Logic, row);
+
+    const quint32 rawCross = Blueprint::RawInk(Blueprint::Cross);
+    const quint32 rawTrace = Blueprint::RawInk(trace);
+    const quint32 rawAnd = Blueprint::RawInk(Blueprint::And);
+    const quint32 rawNor = Blueprint::RawInk(Blueprint::Nor);
+    const quint32 rawRead = Blueprint::RawInk(Blueprint::Read);
+    const quint32 rawWrite = Blueprint::RawInk(Blueprint::Write);
+
+    const auto writeColumns = [&] (quint64 first, quint64 last) {
+
+        const int x0 = 3 + 2 * first, x1 = 3 + 2 * last;
+
+        // crosses, gates, background traces
+        for (int y = 0; y < height; ++ y) {
+            quint32 *line = lines[y];
+            if (y % 2 == 0) {
+                for (int x = x0; x < x1; x += 2) {
+                    line[x] = rawCross;
+                    line[x + 1] = rawTrace;
+                }
+            } else if (y < height - 1) {
+                for (int x = x0; x < x1; x += 2) {
+                    const quint32 gate = ((x - 3) % 4 == 0 ? rawAnd : rawNor);
+                    line[x] = gate;
+                    line[x + 1] = gate;
+                }
+            }
+        }
+
+        // address and data bits
+        for (quint64 position = first; position < last; ++ position) {
+
+            // columns are counted from the input side, addresses from the input side
+            // if address 0 is there and from the far side otherwise.
+            const int col = 4 + 2 * position;
+            const bool isnor = (position % 2 != 0);
+            const quint64 address = columnAddress(addr0Side == Far ? columns - 1 - position : position);
+            const quint64 curdata = data.value(address);
+
+            // ---- data bits
+            int r = (dataLSB == Top ? 0 : (2 * (dataBits - 1)));
+            for (int bit = 0; bit < dataBits; ++ bit) {
+                if (curdata & (1ULL << bit))
+                    lines[r][col] = rawWrite;
+                r += (dataLSB == Top ? 2 : -2);
+            }
+
+            // ---- address bits
+            // - in columns with the nors, the not row gets an R if the bit is 1, otherwise the buffer row gets it.
+            // - in columns with the ands, the buffer row gets an R if the bit is 1, otherwise the not row gets it.
+            r = height - 1;
+            for (int bit = 0; bit < addressBits; ++ bit) {
+                bool one = (address & (1ULL << bit)) != 0;
+                bool rbuf = (isnor != one);
+                // there is no not row for the first bit when !omitEmpty; the and/nor
+                // alternation takes care of it.
+                if (bit == 0 && !omitEmpty) {
+                    lines[r][col] = rawRead;
+                    r -= 2;
+                } else {
+                    lines[rbuf ? r : r - 2][col] = rawRead;
+                    r -= 4;
+                }
+            }
+
+        }
+
+    };
+
+    // each range writes every row of its own columns, so ranges never overlap.
+    constexpr quint64 ColumnsPerJob = 1024;
+    QVector<QPair<quint64,quint64> > jobs;
+    for (quint64 first = 0; first < columns; first += ColumnsPerJob)
+        jobs.append({ first, std::min(first + ColumnsPerJob, columns) });
+    QtConcurrent::blockingMap(jobs, [&] (const QPair<quint64,quint64> &job) {
+        writeColumns(job.first, job.second);
+    });
+
+    return bp;
+
+}
+
+
+// ---- logic minimization for PLA() ------------------------------------------------
+
+// a product term: address bits where mask is set must equal value, drives the data bits in 'outputs'
+struct Cube {
+    quint64 mask;
+    quint64 value;
+    quint64 outputs;
+};
+
+// calls f(address) for every address the cube covers
+template <typename F> static void forEachMinterm (const Cube &cube, quint64 full, F f) {
+    const quint64 free = full & ~cube.mask;
+    quint64 sub = 0;
+    do {
+        f(cube.value | sub);
+        sub = (sub - free) & free;
+    } while (sub != 0);
+}
+
+static int bitCount (quint64 bits) {
+    int count = 0;
+    for (; bits; bits &= bits - 1)
+        ++ count;
+    return count;
+}
+
+// drops terms that are completely covered by the others, least useful first (fewest
+// output bits covered), then drops individual outputs that other terms already cover.
+static void irredundant (QVector<Cube> &cubes, int addressBits, int dataBits) {
+
+    const quint64 full = (1ULL << addressBits) - 1;
+    const auto weight = [&] (const Cube &cube) {
+        return (1ULL << bitCount(full & ~cube.mask)) * bitCount(cube.outputs);
+    };
+
+    QVector<int> order(cubes.size());
+    for (int k = 0; k < order.size(); ++ k)
+        order[k] = k;
+    std::stable_sort(order.begin(), order.end(), [&] (int a, int b) {
+        return weight(cubes[a]) < weight(cubes[b]);
+    });
+
+    // count[address * dataBits + bit] = number of terms driving that bit at that address
+    QVector<quint16> count((1 << addressBits) * dataBits);
+    const auto cover = [&] (const Cube &cube, int delta) {
+        forEachMinterm(cube, full, [&] (quint64 m) {
+            for (int bit = 0; bit < dataBits; ++ bit)
+                if (cube.outputs & (1ULL << bit))
+                    count[m * dataBits + bit] += delta;
+        });
+    };
+    const auto covered = [&] (const Cube &cube, quint64 outputs) {
+        bool redundant = true;
+        forEachMinterm(cube, full, [&] (quint64 m) {
+            for (int bit = 0; bit < dataBits && redundant; ++ bit)
+                if ((outputs & (1ULL << bit)) && count[m * dataBits + bit] < 2)
+                    redundant = false;
+        });
+        return redundant;
+    };
+
+    for (const Cube &cube : cubes)
+        cover(cube, 1);
+
+    for (int k : order) {
+        if (covered(cubes[k], cubes[k].outputs)) {
+            cover(cubes[k], -1);
+            cubes[k].outputs = 0;
+        }
+    }
+
+    for (int k : order) {
+        for (int bit = 0; bit < dataBits; ++ bit) {
+            const quint64 out = 1ULL << bit;
+            if ((cubes[k].outputs & out) && covered(cubes[k], out)) {
+                cover(cubes[k], -1);
+                cubes[k].outputs &= ~out;
+                cover(cubes[k], 1);
+            }
+        }
+    }
+
+    QVector<Cube> kept;
+    for (const Cube &cube : cubes)
+        if (cube.outputs)
+            kept.append(cube);
+    cubes = kept;
+
+}
+
+// single output expand: grow each uncovered on-set address into a prime implicant.
+static QVector<Cube> expandOutput (int addressBits, const QVector<quint64> &data, int bit) {
+
+    const quint64 full = (1ULL << addressBits) - 1;
+    const quint64 size = 1ULL << addressBits;
+    const auto on = [&] (quint64 address) {
+        return (address < (quint64)data.size()) && ((data[address] >> bit) & 1);
+    };
+
+    QVector<quint8> covered(size);
+    QVector<Cube> cubes;
+
+    for (quint64 address = 0; address < size && address < (quint64)data.size(); ++ address) {
+        if (!on(address) || covered[address])
+            continue;
+        Cube cube = { full, address, 1ULL << bit };
+        for (int v = 0; v < addressBits; ++ v) {
+            Cube other = cube;
+            other.value ^= (1ULL << v);
+            bool ok = true;
+            forEachMinterm(other, full, [&] (quint64 m) { ok = ok && on(m); });
+            if (ok) {
+                cube.mask &= ~(1ULL << v);
+                cube.value &= cube.mask;
+            }
+        }
+        forEachMinterm(cube, full, [&] (quint64 m) { covered[m] = 1; });
+        cubes.append(cube);
+    }
+
+    return cubes;
+
+}
+
+// multi-output minimization, espresso-ish but without the reduce/expand iterations: expand
+// each output separately (in parallel), merge identical terms, let every term drive every
+// output it's an implicant of, then drop redundant terms. falls back to one term per nonzero
+// word if that turns out smaller (e.g. for random data).
+static QVector<Cube> minimize (int addressBits, int dataBits, const QVector<quint64> &data) {
+
+    const quint64 full = (1ULL << addressBits) - 1;
+    const quint64 outmask = (dataBits >= 64 ? ~0ULL : ((1ULL << dataBits) - 1));
+
+    struct Job {
+        int bit;
+        QVector<Cube> cubes;
+    };
+
+    QVector<Job> jobs(dataBits);
+    for (int bit = 0; bit < dataBits; ++ bit)
+        jobs[bit].bit = bit;
+    QtConcurrent::blockingMap(jobs, [&] (Job &job) {
+        job.cubes = expandOutput(addressBits, data, job.bit);
+    });
+
+    QVector<Cube> all;
+    for (const Job &job : jobs)
+        for (const Cube &cube : job.cubes)
+            all.append(cube);
+    std::sort(all.begin(), all.end(), [] (const Cube &a, const Cube &b) {
+        return a.mask != b.mask ? a.mask < b.mask : a.value < b.value;
+    });
+
+    QVector<Cube> cubes;
+    for (const Cube &cube : all) {
+        if (!cubes.isEmpty() && cubes.last().mask == cube.mask && cubes.last().value == cube.value)
+            cubes.last().outputs |= cube.outputs;
+        else
+            cubes.append(cube);
+    }
+
+    for (Cube &cube : cubes) {
+        quint64 outputs = outmask;
+        forEachMinterm(cube, full, [&] (quint64 m) { outputs &= data.value(m); });
+        cube.outputs |= outputs;
+    }
+
+    irredundant(cubes, addressBits, dataBits);
+
+    QVector<Cube> minterms;
+    for (quint64 address = 0; address <= full && address < (quint64)data.size(); ++ address)
+        if (data[address] & outmask)
+            minterms.append(Cube{ full, address, data[address] & outmask });
+    if (minterms.size() < cubes.size())
+        cubes = minterms;
+
+    return cubes;
+
+}
+
+
+Blueprint PLA (int addressBits, int dataBits, ROMDataLSBSide dataLSB, const QVector<quint64> &data, ROMStats *stats, ROMStats *romStats) {
+
+    const Blueprint::Ink trace = Blueprint::Trace5;
+
+    if (addressBits < 1 || addressBits > 16)
+        throw runtime_error("Logic minimization supports 1 to 16 address bits.");
+    if (dataBits < 1 || dataBits > 64)
+        throw runtime_error("Logic minimization supports 1 to 64 data bits.");
+
+    QVector<Cube> terms = minimize(addressBits, dataBits, data);
+
+    // a term with no literals would be a gate with no inputs, so split it on bit 0.
+    for (int k = 0; k < terms.size(); ++ k) {
+        if (terms[k].mask == 0) {
+            terms[k].mask = 1;
+            terms.insert(k + 1, Cube{ 1, 1, terms[k].outputs });
+        }
+    }
+    // all zeroes still gets one (empty) column so the outputs have somewhere to be.
+    if (terms.isEmpty())
+        terms.append(Cube{ 0, 0, 0 });
+
+    // same layout as an omitEmpty ROM, one column per term.
+    const int width = 3 + 2 * terms.size() + 1;
+    const int height = 3 + 4 * (addressBits - 1) + 2 * dataBits;
+    qDebug() << "pla will be" << width << "x" << height << "with" << terms.size() << "terms";
+
+    Blueprint bp(width, height);
+    int row, col;
+
+    // address inputs
+    row = height - 1;
+    for (int a = 0; a < addressBits; ++ a) {
+        const int top = (a == 0 ? row - 2 : row - 3);
+        bp.set(1, top, Blueprint::Not);
+        bp.set(2, top, Blueprint::Write);
+        bp.set(0, top + 1, trace);
+        bp.set(1, top + 1, Blueprint::Read);
+        bp.set(1, top + 2, Blueprint::Buffer);
+        bp.set(2, top + 2, Blueprint::Write);
+        row -= (a == 0 ? 3 : 4);
+    }
+
     // crosses, gates, background traces
     for (row = 0; row < height; row += 2) {
         for (col = 3; col < width - 1; col += 2) {
-            bp->set(col, row, Blueprint::Cross);
-            bp->set(col+1, row, trace);
+            bp.set(col, row, Blueprint::Cross);
+            bp.set(col+1, row, trace);
         }
         if (row < height - 1) {
             bool isand = true;
             for (col = 3; col < width - 1; col += 2) {
                 Blueprint::Ink ink = isand ? Blueprint::And : Blueprint::Nor;
-                bp->set(col, row+1, ink);
-                bp->set(col+1, row+1, ink);
+                bp.set(col, row+1, ink);
+                bp.set(col+1, row+1, ink);
                 isand = !isand;
             }
         }
     }
 
-    int lastColumn = 0;
-
-    // address and data bits
-    // to do: truncate if data vector smaller than address space
-    col = (addr0Side == Far ? (width - 2) : (width - 2 * addresses) );
-    bool isnor = (addr0Side == Far);
-    for (quint64 address = 0; address < addresses; ++ address) {
-
-        quint64 curdata = data.value(address);
-        if (omitEmpty && curdata == 0)
-            continue;
+    // terms: an and column reads the buffer row for a 1 literal and the not row for a 0
+    // literal, a nor column the other way around. don't-care bits aren't read at all.
+    int reads = 0, writes = 0;
+    col = 4;
+    bool isnor = false;
+    for (const Cube &term : terms) {
 
-        // ---- data bits
         row = (dataLSB == Top ? 0 : (2 * (dataBits - 1)));
         for (int bit = 0; bit < dataBits; ++ bit) {
-            if (curdata & (1ULL << bit))
-                bp->set(col, row, Blueprint::Write);
+            if (term.outputs & (1ULL << bit)) {
+                bp.set(col, row, Blueprint::Write);
+                ++ writes;
+            }
             row += (dataLSB == Top ? 2 : -2);
         }
 
-        // ---- address bits
-        // - in columns with the nors, the not row gets an R if the bit is 1, otherwise the buffer row gets it.
-        // - in columns with the ands, the buffer row gets an R if the bit is 1, otherwise the not row gets it.
         row = height - 1;
         for (int bit = 0; bit < addressBits; ++ bit) {
-            bool one = (address & (1ULL << bit)) != 0;
-            // i *could* simplify these to logical expressions, but this is why i suck at vcb.
-            bool rbuf = isnor ? (one ? false : true) : (one ? true : false);
-            bool rnot = !rbuf;
-            // there is no not row for the first bit when !omitEmpty
-            if (bit == 0 && !omitEmpty) {
-                /*assert(rbuf);
-                if (rbuf)*/ bp->set(col, row, Blueprint::Read);
-                row -= 2;
-            } else {
-                if (rbuf) bp->set(col, row, Blueprint::Read);
-                if (rnot) bp->set(col, row - 2, Blueprint::Read);
-                row -= 4;
+            if (term.mask & (1ULL << bit)) {
+                bool one = (term.value & (1ULL << bit)) != 0;
+                bp.set(col, (one != isnor) ? row : row - 2, Blueprint::Read);
+                ++ reads;
             }
+            row -= 4;
         }
+
         isnor = !isnor;
+        col += 2;
 
-        // ---- advance
-        if (col > lastColumn) lastColumn = col;
-        col += (addr0Side == Far ? -2 : 2);
+    }
+
+    // outputs
+    for (int bit = 0; bit < dataBits; ++ bit)
+        bp.set(width - 1, bit * 2, trace);
 
+    if (stats) {
+        stats->gates = terms.size() + 2 * addressBits;
+        stats->reads = reads;
+        stats->writes = writes;
+        stats->width = width;
+        stats->height = height;
+        stats->ticks = 2;
     }
 
-    // remove extra columns if requested
-    if (omitEmpty) {
-        assert(addr0Side == Near);
-        for (int col = lastColumn + 1; col < width; ++ col)
-            for (int row = 0; row < height; ++ row) {
-                bp->set(col, row, Blueprint::Empty);
+    // what ROM(addressBits, dataBits, dataLSB, Near, data, false) would have built.
+    if (romStats) {
+        const quint64 addresses = 1ULL << addressBits;
+        const quint64 outmask = (dataBits >= 64 ? ~0ULL : ((1ULL << dataBits) - 1));
+        romStats->gates = addresses + 2 * addressBits - 1;
+        romStats->reads = addresses * addressBits;
+        romStats->writes = 0;
+        for (quint64 address = 0; address < addresses && address < (quint64)data.size(); ++ address)
+            romStats->writes += bitCount(data[address] & outmask);
+        romStats->width = 3 + 2 * addresses + 1;
+        romStats->height = 1 + 4 * (addressBits - 1) + 2 * dataBits;
+        romStats->ticks = 2;
+    }
+
+    return bp;
+
+}
+
+
+// layout for BankedROM() with 2^bankBits banks, see the comments there.
+struct BankedLayout {
+    int lowBits, bankBits;
+    int columns, banks;
+    int busLeft;    // column of the first address bus
+    int gridLeft;   // column of the first crossbar column
+    int outLeft;    // column of the first output bus
+    int top;        // row of the first bank
+    int pitch;      // rows per bank
+    int width, height;
+    BankedLayout (int addressBits, int dataBits, int bankBits) :
+        lowBits(addressBits - bankBits),
+        bankBits(bankBits),
+        columns(1 << lowBits),
+        banks(1 << bankBits),
+        busLeft(4),
+        gridLeft(busLeft + 2 * (2 * addressBits - 1) + 3),
+        outLeft(gridLeft + 2 * columns + 1),
+        top(4 * addressBits),
+        pitch(2 * (dataBits + 2 + 2 * lowBits)),
+        width(outLeft + 2 * dataBits - 1),
+        height(top + banks * pitch)
+    { }
+    int falseBus (int bit) const { return busLeft + 4 * bit; }
+    int trueBus (int bit) const { return busLeft + 4 * bit + 2; }
+    QPoint addressPin (int bit) const { return QPoint(0, 4 * bit + 1); }
+    QPoint outputPin (int bit) const { return QPoint(outLeft + 2 * bit, height - 1); }
+};
+
+
+// reads addresses back 64 at a time (one per lane) and checks every output bit against
+// data. the depth can't be more than the 3 ticks the layout is meant to take (bus, bank
+// select, column); it's less if no column writes anything. roms over 4096 words only get
+// a sample read back (the first and last 64 addresses, and random ones). returns the
+// depth.
+static int verifyBankedROM (const Blueprint &bp, const BankedLayout &L, int addressBits, int dataBits, const QVector<quint64> &data) {
+
+    constexpr int MaxTicks = 3;
+    constexpr quint64 MaxSamples = 4096;
+
+    Compiler compiler(&bp);
+
+    const int ticks = compiler.buildTimingReport(Compiler::TimingSettings(), 0).stats.maxmaxtime;
+    if (ticks > MaxTicks)
+        throw runtime_error(QString("Banked ROM self-check failed: timing analysis says %1 ticks, expected at most %2.").arg(ticks).arg(MaxTicks).toStdString());
+
+    quint64 rng = 0x2545F4914F6CDD1DULL;
+    const quint64 words = 1ULL << addressBits;
+    QVector<quint64> samples;
+    if (words <= MaxSamples) {
+        for (quint64 address = 0; address < words; ++ address)
+            samples.append(address);
+    } else {
+        for (quint64 k = 0; k < 64; ++ k)
+            samples += QVector<quint64>{ k, words - 1 - k };
+        while ((quint64)samples.size() < MaxSamples) {
+            rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+            samples.append(rng & (words - 1));
+        }
+    }
+
+    const quint64 mask = (dataBits >= 64 ? ~0ULL : ((1ULL << dataBits) - 1));
+    Compiler::Evaluator sim(&compiler);
+
+    for (int first = 0; first < samples.size(); first += 64) {
+        const int count = std::min(64, (int)samples.size() - first);
+        for (int bit = 0; bit < addressBits; ++ bit) {
+            quint64 lanes = 0;
+            for (int lane = 0; lane < count; ++ lane)
+                lanes |= ((samples[first + lane] >> bit) & 1) << lane;
+            const QPoint pin = L.addressPin(bit);
+            sim.set(pin.x(), pin.y(), lanes);
+        }
+        sim.step(MaxTicks);
+        for (int bit = 0; bit < dataBits; ++ bit) {
+            const QPoint pin = L.outputPin(bit);
+            const quint64 lanes = sim.get(pin.x(), pin.y());
+            for (int lane = 0; lane < count; ++ lane) {
+                const quint64 address = samples[first + lane];
+                const quint64 expected = ((data.value(address) & mask) >> bit) & 1;
+                if (((lanes >> lane) & 1) != expected)
+                    throw runtime_error(QString("Banked ROM self-check failed: address %1, bit %2 is wrong.").arg(address).arg(bit).toStdString());
             }
+        }
     }
 
-    // outputs
-    for (int bit = 0; bit < dataBits; ++ bit)
-        bp->set(lastColumn + 1, bit * 2, trace);
+    return ticks;
+
+}
+
+
+Blueprint BankedROM (int addressBits, int dataBits, ROMDataLSBSide dataLSB, const QVector<quint64> &data, double aspect, ROMStats *stats) {
+
+    const Blueprint::Ink trace = Blueprint::Trace5;
+
+    if (addressBits < 2)
+        throw runtime_error("Banked ROMs need at least 2 address bits.");
+    if (aspect <= 0)
+        throw runtime_error("Aspect ratio must be positive.");
+
+    // pick the bank count that gets width/height closest to the requested aspect ratio.
+    int bankBits = 1;
+    double bestError = -1;
+    for (int b = 1; b < addressBits; ++ b) {
+        BankedLayout candidate(addressBits, dataBits, b);
+        double error = std::fabs(std::log((double)candidate.width / candidate.height / aspect));
+        if (bestError < 0 || error < bestError) {
+            bestError = error;
+            bankBits = b;
+        }
+    }
+
+    const BankedLayout L(addressBits, dataBits, bankBits);
+    qDebug() << "banked rom will be" << L.width << "x" << L.height << "with" << L.banks << "banks of" << L.columns;
+
+    Blueprint bp(L.width, L.height);
+    int row, col;
+
+    // everything is written straight into the logic layer, like ROM()
+    QVector<quint32 *> lines(L.height);
+    for (row = 0; row < L.height; ++ row)
+        lines[row] = bp.scanLine(Blueprint::Logic, row);
+
+    const quint32 rawEmpty = Blueprint::RawInk(Blueprint::Empty);
+    const quint32 rawCross = Blueprint::RawInk(Blueprint::Cross);
+    const quint32 rawTrace = Blueprint::RawInk(trace);
+    const quint32 rawAnd = Blueprint::RawInk(Blueprint::And);
+    const quint32 rawNor = Blueprint::RawInk(Blueprint::Nor);
+    const quint32 rawNand = Blueprint::RawInk(Blueprint::Nand);
+    const quint32 rawNot = Blueprint::RawInk(Blueprint::Not);
+    const quint32 rawBuffer = Blueprint::RawInk(Blueprint::Buffer);
+    const quint32 rawRead = Blueprint::RawInk(Blueprint::Read);
+    const quint32 rawWrite = Blueprint::RawInk(Blueprint::Write);
+
+    // address inputs: each input at (0, 4*bit+1) drives a not and a buffer, and those
+    // become a false and true bus running down the whole rom. header rows cross the
+    // busses of lower bits.
+    for (int bit = 0; bit < addressBits; ++ bit) {
+        row = 4 * bit;
+        lines[row][1] = rawNot;
+        lines[row][2] = rawWrite;
+        lines[row + 1][0] = rawTrace;
+        lines[row + 1][1] = rawRead;
+        lines[row + 2][1] = rawBuffer;
+        lines[row + 2][2] = rawWrite;
+        for (int r : { row, row + 2 }) {
+            const int end = (r == row ? L.falseBus(bit) : L.trueBus(bit));
+            std::fill(lines[r] + 3, lines[r] + end + 1, rawTrace);
+            for (col = L.busLeft; col < end; col += 2)
+                lines[r][col] = rawCross;
+        }
+        for (row = 4 * bit + 1; row < L.height; ++ row) {
+            quint32 *line = lines[row];
+            if (row != 4 * bit + 2 && line[L.falseBus(bit)] != rawCross)
+                line[L.falseBus(bit)] = rawTrace;
+            if (row > 4 * bit + 2 && line[L.trueBus(bit)] != rawCross)
+                line[L.trueBus(bit)] = rawTrace;
+        }
+    }
+
+    // banks: data lines, bank select lines, then a true/false line per low address bit,
+    // all crossed by alternating and/nor gate columns like the plain rom.
+    const int rows = dataBits + 2 + 2 * L.lowBits;
+    const int selRow = 2 * dataBits;            // and'd bank select
+    const int nselRow = selRow + 2;             // nand'd bank select, for the nor columns
+    const auto lowRow = [&] (int bit, bool value) { return selRow + 4 + 4 * bit + (value ? 0 : 2); };
+    const auto dataRow = [&] (int bit) { return dataLSB == Top ? 2 * bit : 2 * (dataBits - 1 - bit); };
+
+    for (int bank = 0; bank < L.banks; ++ bank) {
+
+        const int y0 = L.top + bank * L.pitch;
+
+        // crossbar
+        for (int line = 0; line < rows; ++ line) {
+            quint32 *wires = lines[y0 + 2 * line];
+            for (col = L.gridLeft; col < L.outLeft - 1; col += 2) {
+                wires[col] = rawCross;
+                wires[col + 1] = rawTrace;
+            }
+            if (line < rows - 1) {
+                quint32 *gates = lines[y0 + 2 * line + 1];
+                for (col = L.gridLeft; col < L.outLeft - 1; col += 2) {
+                    const quint32 gate = ((col - L.gridLeft) % 4 == 0 ? rawAnd : rawNor);
+                    gates[col] = gate;
+                    gates[col + 1] = gate;
+                }
+            }
+        }
+
+        // low address lines tap their busses, crossing the busses to their right
+        for (int bit = 0; bit < L.lowBits; ++ bit) {
+            for (bool value : { true, false }) {
+                quint32 *line = lines[y0 + lowRow(bit, value)];
+                const int bus = (value ? L.trueBus(bit) : L.falseBus(bit));
+                for (col = bus + 1; col < L.gridLeft; ++ col)
+                    line[col] = (col < L.gridLeft - 1 && (col - L.busLeft) % 2 == 0) ? rawCross : rawTrace;
+            }
+        }
+
+        // predecoder: an and strip and a nand strip across the high address busses,
+        // reading the literals that select this bank. each strip is two rows, the
+        // busses pass through on a cross in the upper row and a trace (or a read) in the
+        // lower one.
+        for (int strip = 0; strip < 2; ++ strip) {
+            const quint32 gate = (strip == 0 ? rawAnd : rawNand);
+            row = y0 + (strip == 0 ? selRow : nselRow);
+            for (col = L.falseBus(L.lowBits) - 1; col < L.gridLeft - 1; ++ col) {
+                if ((col - L.busLeft) % 2 == 0) {
+                    lines[row - 1][col] = rawCross;
+                } else {
+                    lines[row - 1][col] = gate;
+                    lines[row][col] = gate;
+                }
+            }
+            for (int bit = L.lowBits; bit < addressBits; ++ bit) {
+                const bool one = (bank >> (bit - L.lowBits)) & 1;
+                lines[row][one ? L.trueBus(bit) : L.falseBus(bit)] = rawRead;
+            }
+            lines[row][L.gridLeft - 1] = rawWrite;
+        }
+
+        // columns
+        bool isnor = false;
+        col = L.gridLeft + 1;
+        for (int c = 0; c < L.columns; ++ c) {
+            const quint64 address = ((quint64)bank << L.lowBits) | c;
+            const quint64 curdata = data.value(address);
+            for (int bit = 0; bit < dataBits; ++ bit)
+                if (curdata & (1ULL << bit))
+                    lines[y0 + dataRow(bit)][col] = rawWrite;
+            lines[y0 + (isnor ? nselRow : selRow)][col] = rawRead;
+            for (int bit = 0; bit < L.lowBits; ++ bit) {
+                const bool one = (address & (1ULL << bit)) != 0;
+                const bool rtrue = isnor ? !one : one;
+                lines[y0 + lowRow(bit, rtrue)][col] = rawRead;
+            }
+            isnor = !isnor;
+            col += 2;
+        }
+
+        // data lines run out to their output busses, crossing the busses of lower bits
+        for (int bit = 0; bit < dataBits; ++ bit) {
+            quint32 *line = lines[y0 + dataRow(bit)];
+            for (col = L.outLeft - 1; col <= L.outLeft + 2 * bit; ++ col)
+                line[col] = (col < L.outLeft + 2 * bit && (col - L.outLeft) % 2 == 0) ? rawCross : rawTrace;
+        }
+
+    }
+
+    // output busses run from the first bank to the bottom edge
+    for (int bit = 0; bit < dataBits; ++ bit) {
+        col = L.outLeft + 2 * bit;
+        for (row = L.top; row < L.height; ++ row)
+            if (lines[row][col] == rawEmpty)
+                lines[row][col] = rawTrace;
+    }
+
+    const int ticks = verifyBankedROM(bp, L, addressBits, dataBits, data);
+
+    if (stats) {
+        stats->gates = L.banks * (L.columns + 2) + 2 * addressBits;
+        stats->reads = L.banks * (L.columns * (L.lowBits + 1) + 2 * L.bankBits);
+        stats->writes = 0;
+        for (quint64 address = 0; address < (1ULL << addressBits) && address < (quint64)data.size(); ++ address)
+            for (quint64 d = data[address] & (dataBits >= 64 ? ~0ULL : ((1ULL << dataBits) - 1)); d; d &= d - 1)
+                ++ stats->writes;
+        stats->width = L.width;
+        stats->height = L.height;
+        stats->ticks = ticks;
+    }
 
     return bp;
 
 }
 
 
-Blueprint * Text (QImage font, QString fontCharset, int kerning, QString text, Blueprint::Ink logicInk, Blueprint::Ink decoOnInk, Blueprint::Ink decoOffInk) {
+// layout for RAM(), see the comments there. ports are numbered write ports first.
+struct RAMLayout {
+    int addressBits, dataBits, readPorts, writePorts, ports;
+    int words;
+    int blockWidth;     // columns per word
+    int cellHeight;     // rows per data bit
+    QVector<int> decoderTop;
+    int arrayTop;
+    int width, height;
+    RAMLayout (int addressBits, int dataBits, int readPorts, int writePorts) :
+        addressBits(addressBits),
+        dataBits(dataBits),
+        readPorts(readPorts),
+        writePorts(writePorts),
+        ports(readPorts + writePorts),
+        words(1 << addressBits),
+        blockWidth(2 * ports + 7),
+        cellHeight(6 * writePorts + 2 + 4 * readPorts)
+    {
+        int top = 0;
+        for (int port = 0; port < ports; ++ port) {
+            decoderTop.append(top);
+            top += 4 * addressBits + (isWrite(port) ? 6 : 2);
+        }
+        arrayTop = top;
+        width = blockLeft(words);
+        height = arrayTop + dataBits * cellHeight - 1;
+    }
+    bool isWrite (int port) const { return port < writePorts; }
+    int blockLeft (int word) const { return 4 + word * blockWidth; }
+    int selectLine (int word, int port) const { return blockLeft(word) + 2 * port; }
+    int core (int word) const { return blockLeft(word) + 2 * ports; }
+    int lastLine (int port) const { return decoderTop[port] + 4 * addressBits + (isWrite(port) ? 2 : -2); }
+    int outputRow (int port) const { return lastLine(port) + 2; }
+    int cellTop (int bit) const { return arrayTop + bit * cellHeight; }
+    QPoint addressPin (int port, int bit) const { return QPoint(0, decoderTop[port] + 4 * bit + 1); }
+    QPoint enablePin (int port) const { return QPoint(0, decoderTop[port] + 4 * addressBits + 1); }
+    QPoint dataPin (int port, int bit) const { return QPoint(0, cellTop(bit) + 6 * port); }
+    QPoint outputPin (int port, int bit) const { return QPoint(width - 1, cellTop(bit) + 6 * writePorts + 2 + 4 * (port - writePorts)); }
+    QPoint latch (int word, int bit) const { return QPoint(core(word) + 2, cellTop(bit) + 6 * writePorts); }
+};
+
+
+// writes random data through every write port and reads it back through every read
+// port, 64 rams at a time, checking each latch after the write latency and each output
+// after the read latency. big rams only get a sample of their words checked (the ends,
+// every one-hot and one-cold address, and random ones); every other word has to still
+// be empty afterwards, which catches decoder aliasing.
+static void verifyRAM (const Blueprint &bp, const RAMLayout &L, int readTicks, int writeTicks) {
+
+    constexpr int MaxSamples = 64;
+
+    Compiler compiler(&bp);
+    Compiler::Evaluator sim(&compiler);
+
+    quint64 rng = 0x2545F4914F6CDD1DULL;
+    const auto random = [&rng] () {
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        return rng;
+    };
+
+    QVector<int> samples;
+    QVector<bool> sampled(L.words, false);
+    const auto sample = [&] (int word) {
+        if (!sampled[word]) {
+            sampled[word] = true;
+            samples.append(word);
+        }
+    };
+    if (L.words <= MaxSamples) {
+        for (int word = 0; word < L.words; ++ word)
+            sample(word);
+    } else {
+        sample(0);
+        sample(L.words - 1);
+        for (int bit = 0; bit < L.addressBits; ++ bit) {
+            sample((1 << bit) & (L.words - 1));
+            sample(~(1 << bit) & (L.words - 1));
+        }
+        while (samples.size() < MaxSamples)
+            sample(random() % L.words);
+    }
+
+    const auto setAddress = [&] (int port, int word) {
+        for (int bit = 0; bit < L.addressBits; ++ bit) {
+            QPoint pin = L.addressPin(port, bit);
+            sim.set(pin.x(), pin.y(), ((word >> bit) & 1) ? ~0ULL : 0);
+        }
+    };
+
+    const auto fail = [] (QString what, int port, int word, int bit) {
+        throw runtime_error(QString("RAM self-check failed: %1 on port %2, address %3, bit %4.")
+                            .arg(what).arg(port).arg(word).arg(bit).toStdString());
+    };
+
+    QVector<quint64> expected(L.words * L.dataBits); // [word * dataBits + bit]
+
+    for (int port = 0; port < L.writePorts; ++ port) {
+        for (int word : samples) {
+            setAddress(port, word);
+            for (int bit = 0; bit < L.dataBits; ++ bit) {
+                quint64 value = random();
+                expected[word * L.dataBits + bit] = value;
+                QPoint pin = L.dataPin(port, bit);
+                sim.set(pin.x(), pin.y(), value);
+            }
+            QPoint enable = L.enablePin(port);
+            sim.set(enable.x(), enable.y(), ~0ULL);
+            sim.step(writeTicks);
+            for (int bit = 0; bit < L.dataBits; ++ bit) {
+                QPoint cell = L.latch(word, bit);
+                if (sim.get(cell.x(), cell.y()) != expected[word * L.dataBits + bit])
+                    fail("write", port, word, bit);
+            }
+            // data has to be held until the enable is through the decoder
+            sim.set(enable.x(), enable.y(), 0);
+            sim.step(2);
+        }
+    }
+
+    for (int word = 0; word < L.words; ++ word) {
+        if (sampled[word])
+            continue;
+        for (int bit = 0; bit < L.dataBits; ++ bit) {
+            QPoint cell = L.latch(word, bit);
+            if (sim.get(cell.x(), cell.y()) != 0)
+                throw runtime_error(QString("RAM self-check failed: address %1, bit %2 was written without being addressed.")
+                                    .arg(word).arg(bit).toStdString());
+        }
+    }
+
+    // every read port reads a different word each pass
+    for (int pass = 0; pass < samples.size(); ++ pass) {
+        for (int reader = L.writePorts; reader < L.ports; ++ reader)
+            setAddress(reader, samples[(pass + reader) % samples.size()]);
+        sim.step(readTicks);
+        for (int reader = L.writePorts; reader < L.ports; ++ reader) {
+            const int word = samples[(pass + reader) % samples.size()];
+            for (int bit = 0; bit < L.dataBits; ++ bit) {
+                QPoint pin = L.outputPin(reader, bit);
+                if (sim.get(pin.x(), pin.y()) != expected[word * L.dataBits + bit])
+                    fail("read", reader, word, bit);
+            }
+        }
+    }
+
+}
+
+
+Blueprint RAM (int addressBits, int dataBits, int readPorts, int writePorts, RAMStats *stats) {
+
+    const Blueprint::Ink trace = Blueprint::Trace5;
+
+    if (addressBits < 1 || addressBits > 10)
+        throw runtime_error("RAMs need 1 to 10 address bits.");
+    if (dataBits < 1 || dataBits > 64)
+        throw runtime_error("RAMs need 1 to 64 data bits.");
+    if (readPorts < 1 || writePorts < 1)
+        throw runtime_error("RAMs need at least one read port and one write port.");
+
+    // each word is a block of columns: a select line per port, then a column of
+    // cells, one per data bit. each port has its own decoder above the cells, built
+    // like the rom's: an and column per word reading the true or false line of every
+    // address bit (and the write enable, for write ports), which drives that word's
+    // select line for the port.
+    //
+    // a cell stores its bit in a latch, Q. a write port toggles it when the port's
+    // select line is on and its data line differs from Q (select & (D ^ Q)), which turns
+    // itself off as soon as Q flips. a read port ands its select line with Q onto its
+    // output line. all of a cell's horizontal lines (data in and out) run through every
+    // word; the latch input and Q are short vertical traces inside the cell.
+    const RAMLayout L(addressBits, dataBits, readPorts, writePorts);
+    qDebug() << "ram will be" << L.width << "x" << L.height;
+
+    Blueprint bp(L.width, L.height);
+
+    // inputs: each decoder's address bits, the write enables, and the data lines
+    for (int port = 0; port < L.ports; ++ port) {
+        const int top = L.decoderTop[port];
+        for (int bit = 0; bit < addressBits; ++ bit) {
+            const int row = top + 4 * bit;
+            bp.set(1, row, Blueprint::Not);
+            bp.set(2, row, Blueprint::Write);
+            bp.set(0, row + 1, trace);
+            bp.set(1, row + 1, Blueprint::Read);
+            bp.set(1, row + 2, Blueprint::Buffer);
+            bp.set(2, row + 2, Blueprint::Write);
+        }
+        if (L.isWrite(port)) {
+            const int row = top + 4 * addressBits;
+            bp.set(0, row + 1, trace);
+            bp.set(1, row + 1, Blueprint::Read);
+            bp.set(1, row + 2, Blueprint::Buffer);
+            bp.set(2, row + 2, Blueprint::Write);
+        }
+    }
+    for (int bit = 0; bit < dataBits; ++ bit) {
+        for (int port = 0; port < writePorts; ++ port) {
+            const int row = L.dataPin(port, bit).y();
+            bp.hline(Blueprint::Logic, 0, row, L.blockLeft(0), trace);
+        }
+    }
+
+    // decoder lines start at column 3; everything else is written straight into the
+    // logic layer one block of words at a time.
+    QVector<quint32 *> lines(L.height);
+    for (int row = 0; row < L.height; ++ row)
+        lines[row] = bp.scanLine(Blueprint::Logic, row);
+
+    const quint32 rawCross = Blueprint::RawInk(Blueprint::Cross);
+    const quint32 rawTrace = Blueprint::RawInk(trace);
+    const quint32 rawAnd = Blueprint::RawInk(Blueprint::And);
+    const quint32 rawXor = Blueprint::RawInk(Blueprint::Xor);
+    const quint32 rawLatch = Blueprint::RawInk(Blueprint::LatchOff);
+    const quint32 rawRead = Blueprint::RawInk(Blueprint::Read);
+    const quint32 rawWrite = Blueprint::RawInk(Blueprint::Write);
+
+    for (int port = 0; port < L.ports; ++ port) {
+        for (int line = L.decoderTop[port]; line <= L.lastLine(port); line += 2) {
+            if (line != L.decoderTop[port] + 4 * addressBits)
+                lines[line][3] = rawTrace;
+        }
+    }
+
+    const auto writeWords = [&] (int first, int last) {
+
+        for (int word = first; word < last; ++ word) {
+
+            const int x0 = L.blockLeft(word), x1 = x0 + L.blockWidth;
+            const int core = L.core(word);
+
+            // ---- decoders
+
+            for (int port = 0; port < L.ports; ++ port) {
+
+                const int top = L.decoderTop[port];
+                const int gap = top + 4 * addressBits; // the row between the address and enable lines
+                const int gate = core + 1;
+
+                // literal lines cross the select lines of earlier ports
+                for (int row = top; row <= L.lastLine(port); row += 2) {
+                    if (row == gap)
+                        continue;
+                    quint32 *line = lines[row];
+                    for (int x = x0; x < x1; ++ x)
+                        line[x] = rawTrace;
+                    for (int p = 0; p < port; ++ p)
+                        line[L.selectLine(word, p)] = rawCross;
+                    line[gate] = rawCross;
+                }
+
+                // the and column reads the literals that match this word
+                for (int row = top + 1; row <= L.lastLine(port) + 1; ++ row) {
+                    if (row % 2 != top % 2 || row == gap) {
+                        lines[row][gate] = rawAnd;
+                        lines[row][gate + 1] = rawAnd;
+                    }
+                }
+                for (int bit = 0; bit < addressBits; ++ bit) {
+                    const bool one = (word >> bit) & 1;
+                    lines[top + 4 * bit + (one ? 2 : 0)][gate + 1] = rawRead;
+                }
+                if (L.isWrite(port))
+                    lines[gap + 2][gate + 1] = rawRead;
+
+                // and drives the select line, which runs down to the bottom
+                quint32 *out = lines[L.outputRow(port)];
+                for (int x = L.selectLine(word, port); x < gate; ++ x)
+                    out[x] = rawTrace;
+                out[gate] = rawWrite;
+                for (int row = L.outputRow(port) + 1; row < L.height; ++ row)
+                    lines[row][L.selectLine(word, port)] = rawTrace;
+
+            }
+
+            // ---- cells
+
+            for (int bit = 0; bit < dataBits; ++ bit) {
+
+                const int y0 = L.cellTop(bit);
 
-    qDebug().noquote() << fontCharset;
+                // a horizontal line through the block, crossing the select lines, the
+                // latch input and Q.
+                const auto crossLine = [&] (int row) {
+                    quint32 *line = lines[row];
+                    for (int x = x0; x < x1; ++ x)
+                        line[x] = rawTrace;
+                    for (int p = 0; p < L.ports; ++ p)
+                        line[L.selectLine(word, p)] = rawCross;
+                    line[core + 1] = rawCross;
+                    line[core + 3] = rawCross;
+                };
 
-    // ABCDEFGHIJKLMNOPQRSTUVWXYZ 0123456789 _.:! +-*/\= "' |^& ()[]<> @~#,?%{}`¬
-    //constexpr char charset[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ 0123456789.!:+-*/\\=()[]|^&_<>\"'@~#,?%{}`\xAC";
-    //constexpr int charsetlen = sizeof(charset) - 1;
-    const QByteArray charset = fontCharset.toLatin1();
-    const int charsetlen = charset.length();
+                // a horizontal gate strip from the port's select line into the cell,
+                // crossing the select lines of later ports.
+                const auto strip = [&] (int row, int port, quint32 gate) {
+                    quint32 *line = lines[row];
+                    line[L.selectLine(word, port)] = rawRead;
+                    for (int x = L.selectLine(word, port) + 1; x <= core; ++ x)
+                        line[x] = ((x - x0) % 2 == 0 && x < core ? rawCross : gate);
+                };
 
-    if (font.width() % charsetlen != 0)
+                // latch input (core + 1) and Q (core + 3) run the height of the cell
+                for (int row = y0 + 1; row < y0 + L.cellHeight - 1; ++ row) {
+                    lines[row][core + 1] = rawTrace;
+                    lines[row][core + 3] = rawTrace;
+                }
+
+                for (int port = 0; port < writePorts; ++ port) {
+                    const int t = y0 + 6 * port;
+                    crossLine(t);
+                    lines[t][core + 4] = rawRead;           // D
+                    lines[t + 1][core + 4] = rawXor;
+                    lines[t + 2][core + 4] = rawXor;
+                    lines[t + 2][core + 3] = rawRead;       // Q
+                    lines[t + 2][core + 5] = rawWrite;
+                    lines[t + 3][core + 5] = rawRead;
+                    lines[t + 3][core] = rawAnd;
+                    lines[t + 3][core + 1] = rawWrite;      // latch input
+                    lines[t + 3][core + 2] = rawAnd;
+                    lines[t + 3][core + 3] = rawCross;
+                    lines[t + 3][core + 4] = rawAnd;
+                    strip(t + 4, port, rawAnd);
+                    lines[t + 4][core + 1] = rawCross;
+                    lines[t + 4][core + 2] = rawAnd;
+                    lines[t + 4][core + 4] = rawAnd;
+                }
+
+                const int s = y0 + 6 * writePorts;
+                lines[s][core + 1] = rawRead;
+                lines[s][core + 2] = rawLatch;
+                lines[s][core + 3] = rawWrite;
+
+                for (int port = writePorts; port < L.ports; ++ port) {
+                    const int t = s + 2 + 4 * (port - writePorts);
+                    crossLine(t);
+                    lines[t][core + 2] = rawWrite;          // out
+                    lines[t + 1][core + 2] = rawAnd;
+                    strip(t + 2, port, rawAnd);
+                    lines[t + 2][core + 1] = rawCross;
+                    lines[t + 2][core + 2] = rawAnd;
+                    lines[t + 2][core + 3] = rawRead;       // Q
+                }
+
+            }
+
+        }
+
+    };
+
+    // each range writes only its own blocks, so ranges never overlap.
+    constexpr int WordsPerJob = 64;
+    QVector<QPair<int,int> > jobs;
+    for (int first = 0; first < L.words; first += WordsPerJob)
+        jobs.append({ first, std::min(first + WordsPerJob, L.words) });
+    QtConcurrent::blockingMap(jobs, [&] (const QPair<int,int> &job) {
+        writeWords(job.first, job.second);
+    });
+
+    // address (or enable) -> buffer or not -> decoder -> cell gate (-> latch)
+    const int readTicks = 3, writeTicks = 4;
+
+    verifyRAM(bp, L, readTicks, writeTicks);
+
+    if (stats) {
+        const int cells = L.words * dataBits;
+        stats->gates = L.ports * (L.words + 2 * addressBits) + writePorts + cells * (2 * writePorts + readPorts);
+        stats->latches = cells;
+        stats->width = L.width;
+        stats->height = L.height;
+        stats->readTicks = readTicks;
+        stats->writeTicks = writeTicks;
+    }
+
+    return bp;
+
+}
+
+
+// ---- arithmetic ------------------------------------------------------------------
+
+// a gate netlist for layoutNetlist(). nets with more than one driver are wired ors,
+// which is what makes an and-or (a carry, a mux) cost a single tick, and a gate can
+// drive several nets. gates have to be added after every driver of the nets they read.
+// every net belongs to a slice (usually a bit); slices are laid out as bands of rows
+// from the top, so gates that stay within a few neighbouring slices stay short.
+struct Netlist {
+    struct Gate {
+        Blueprint::Ink ink;
+        QVector<int> inputs;
+        QVector<int> outputs;
+    };
+    int slice;            // slice of nets created from now on
+    QVector<int> slices;  // slice of every net
+    QVector<int> inputs;  // in pin order within each slice
+    QVector<int> outputs; // in pin order within each slice
+    QVector<Gate> gates;
+    Netlist () : slice(0) { }
+    int nets () const { return slices.size(); }
+    int net () { slices.append(slice); return slices.size() - 1; }
+    int input () { inputs.append(net()); return inputs.last(); }
+    int gate (Blueprint::Ink ink, const QVector<int> &from, int output = -1) {
+        if (output < 0)
+            output = net();
+        gates.append(Gate{ ink, from, { output } });
+        return output;
+    }
+    // one gate driving a copy of its output in each of the given slices
+    QVector<int> fanout (Blueprint::Ink ink, const QVector<int> &from, const QVector<int> &to) {
+        QVector<int> outputs;
+        const int current = slice;
+        for (int s : to) {
+            slice = s;
+            outputs.append(net());
+        }
+        slice = current;
+        gates.append(Gate{ ink, from, outputs });
+        return outputs;
+    }
+};
+
+
+// where layoutNetlist() put things
+struct NetlistLayout {
+    QVector<QPoint> inputs, outputs; // pins, same order as the netlist
+    int gates;
+    int ticks; // longest input to output path
+};
+
+
+// crossbar layout: every net is a horizontal line, every gate a two pixel wide vertical
+// strip reading and writing the lines it spans, like the rom columns. gates are placed
+// in columns by depth; gates of the same depth share a column when their strips don't
+// overlap, and nets within a slice share a row when they're never alive in the same
+// column. inputs enter on the left edge and outputs leave on the right edge, each at
+// the top and bottom of its slice.
+static Blueprint layoutNetlist (const Netlist &N, NetlistLayout *layout) {
+
+    const Blueprint::Ink trace = Blueprint::Trace5;
+    const int Never = std::numeric_limits<int>::max();
+    const int nets = N.nets();
+
+    // ---- drop gates nothing depends on (e.g. propagates of the last prefix level)
+
+    QVector<bool> needed(nets, false), live(N.gates.size(), false);
+    for (int net : N.outputs)
+        needed[net] = true;
+    for (int g = N.gates.size() - 1; g >= 0; -- g) {
+        for (int net : N.gates[g].outputs)
+            live[g] = live[g] || needed[net];
+        if (live[g])
+            for (int net : N.gates[g].inputs)
+                needed[net] = true;
+    }
+
+    // ---- depth of every gate and the span of every net, in depths
+
+    QVector<int> gateDepth(N.gates.size(), 0);
+    QVector<int> netDepth(nets, 0), first(nets, Never), last(nets, -1);
+    for (int net : N.inputs) {
+        first[net] = 0;
+        last[net] = 0;
+    }
+    int gates = 0;
+    for (int g = 0; g < N.gates.size(); ++ g) {
+        if (!live[g])
+            continue;
+        ++ gates;
+        int depth = 0;
+        for (int net : N.gates[g].inputs)
+            depth = std::max(depth, netDepth[net]);
+        gateDepth[g] = ++ depth;
+        for (int net : N.gates[g].inputs)
+            last[net] = std::max(last[net], depth);
+        for (int net : N.gates[g].outputs) {
+            netDepth[net] = std::max(netDepth[net], depth);
+            first[net] = std::min(first[net], depth);
+        }
+    }
+    QVector<bool> isOutput(nets, false);
+    for (int net : N.outputs)
+        isOutput[net] = true;
+
+    int ticks = 0;
+    for (int net : N.outputs)
+        ticks = std::max(ticks, netDepth[net]);
+
+    // ---- rows: a band per slice. inputs first, then left edge allocation of whatever
+    // is used, then the outputs.
+
+    QVector<int> sliceOrder;
+    for (int net = 0; net < nets; ++ net)
+        if (!sliceOrder.contains(N.slices[net]))
+            sliceOrder.append(N.slices[net]);
+    std::sort(sliceOrder.begin(), sliceOrder.end());
+
+    QVector<int> track(nets, -1);
+    int tracks = 0;
+    for (int slice : sliceOrder) {
+        QVector<int> order;
+        for (int net = 0; net < nets; ++ net)
+            if (N.slices[net] == slice && !isOutput[net] && first[net] != Never && last[net] >= 0)
+                order.append(net);
+        std::stable_sort(order.begin(), order.end(), [&] (int a, int b) { return first[a] < first[b]; });
+        QVector<int> trackEnd; // last depth used on each track of the band
+        for (int net : order) {
+            int t = 0;
+            while (t < trackEnd.size() && trackEnd[t] >= first[net])
+                ++ t;
+            if (t == trackEnd.size())
+                trackEnd.append(-1);
+            trackEnd[t] = last[net];
+            track[net] = tracks + t;
+        }
+        tracks += trackEnd.size();
+        for (int net : N.outputs)
+            if (N.slices[net] == slice)
+                track[net] = tracks ++;
+    }
+
+    // ---- columns: interval coloring of the gate strips within each depth
+
+    struct Strip {
+        int gate;
+        int top, bottom; // tracks
+    };
+    QVector<QVector<Strip> > columns;
+    for (int depth = 1; depth <= ticks; ++ depth) {
+        QVector<Strip> strips;
+        for (int g = 0; g < N.gates.size(); ++ g) {
+            if (!live[g] || gateDepth[g] != depth)
+                continue;
+            Strip strip = { g, tracks, -1 };
+            for (int net : N.gates[g].inputs + N.gates[g].outputs) {
+                if (track[net] < 0) // an output copy nothing reads
+                    continue;
+                strip.top = std::min(strip.top, track[net]);
+                strip.bottom = std::max(strip.bottom, track[net]);
+            }
+            strips.append(strip);
+        }
+        std::sort(strips.begin(), strips.end(), [] (const Strip &a, const Strip &b) { return a.top < b.top; });
+        const int depthStart = columns.size();
+        for (const Strip &strip : strips) {
+            int c = depthStart;
+            while (c < columns.size() && columns[c].last().bottom >= strip.top)
+                ++ c;
+            if (c == columns.size())
+                columns.append(QVector<Strip>());
+            columns[c].append(strip);
+        }
+    }
+
+    // column of the first driver and last reader of each net
+    QVector<int> firstColumn(nets, Never), lastColumn(nets, -1);
+    for (int c = 0; c < columns.size(); ++ c) {
+        for (const Strip &strip : columns[c]) {
+            const Netlist::Gate &gate = N.gates[strip.gate];
+            for (int net : gate.outputs)
+                firstColumn[net] = std::min(firstColumn[net], c);
+            for (int net : gate.inputs)
+                lastColumn[net] = std::max(lastColumn[net], c);
+        }
+    }
+
+    // ---- draw
+
+    const int left = 2;
+    const auto columnX = [&] (int c) { return left + 3 * c; };
+    const int width = columnX(columns.size()) + 1;
+    const int height = 2 * tracks - 1;
+    qDebug() << "netlist will be" << width << "x" << height << "with" << gates << "gates in" << columns.size() << "columns";
+
+    Blueprint bp(width, height);
+
+    QVector<quint32 *> lines(height);
+    for (int row = 0; row < height; ++ row)
+        lines[row] = bp.scanLine(Blueprint::Logic, row);
+
+    const quint32 rawEmpty = Blueprint::RawInk(Blueprint::Empty);
+    const quint32 rawTrace = Blueprint::RawInk(trace);
+    const quint32 rawCross = Blueprint::RawInk(Blueprint::Cross);
+    const quint32 rawRead = Blueprint::RawInk(Blueprint::Read);
+    const quint32 rawWrite = Blueprint::RawInk(Blueprint::Write);
+
+    for (int net = 0; net < nets; ++ net) {
+        if (track[net] < 0)
+            continue;
+        const int x0 = (firstColumn[net] == Never ? 0 : columnX(firstColumn[net]) + 1);
+        const int x1 = (isOutput[net] ? width - 1 : columnX(lastColumn[net]) + 1);
+        quint32 *line = lines[2 * track[net]];
+        for (int x = x0; x <= x1; ++ x)
+            line[x] = rawTrace;
+    }
+
+    for (int c = 0; c < columns.size(); ++ c) {
+        const int x = columnX(c);
+        for (const Strip &strip : columns[c]) {
+            const Netlist::Gate &gate = N.gates[strip.gate];
+            const quint32 ink = Blueprint::RawInk(gate.ink);
+            // lines passing through the strip get a cross on the left, the strip fills
+            // in wherever there's no line.
+            for (int row = 2 * strip.top + 1; row < 2 * strip.bottom; ++ row) {
+                if (lines[row][x] == rawTrace) {
+                    lines[row][x] = rawCross;
+                } else {
+                    lines[row][x] = ink;
+                    if (lines[row][x + 1] == rawEmpty)
+                        lines[row][x + 1] = ink;
+                }
+            }
+            for (int net : gate.inputs)
+                lines[2 * track[net]][x + 1] = rawRead;
+            for (int net : gate.outputs)
+                if (track[net] >= 0)
+                    lines[2 * track[net]][x + 1] = rawWrite;
+        }
+    }
+
+    if (layout) {
+        layout->inputs.clear();
+        layout->outputs.clear();
+        for (int net : N.inputs)
+            layout->inputs.append(QPoint(0, 2 * track[net]));
+        for (int net : N.outputs)
+            layout->outputs.append(QPoint(width - 1, 2 * track[net]));
+        layout->gates = gates;
+        layout->ticks = ticks;
+    }
+
+    return bp;
+
+}
+
+
+// checks a generated circuit: the timing analysis has to agree with the netlist depth,
+// and random inputs (64 sets at a time) have to produce what 'reference' computes after
+// that many ticks. reference maps input bits to output bits, both in pin order.
+static void verifyArithmetic (const Blueprint &bp, const NetlistLayout &layout, const std::function<QVector<bool>(const QVector<bool> &)> &reference, ArithmeticStats *stats) {
+
+    Compiler compiler(&bp);
+
+    const int ticks = compiler.buildTimingReport(Compiler::TimingSettings(), 0).stats.maxmaxtime;
+    if (ticks != layout.ticks)
+        throw runtime_error(QString("Self-check failed: timing analysis says %1 ticks, expected %2.").arg(ticks).arg(layout.ticks).toStdString());
+
+    Compiler::Evaluator sim(&compiler);
+    quint64 rng = 0x2545F4914F6CDD1DULL;
+    QVector<quint64> in(layout.inputs.size()), out(layout.outputs.size());
+    QVector<bool> bits(layout.inputs.size());
+
+    for (int round = 0; round < 16; ++ round) {
+        for (int k = 0; k < in.size(); ++ k) {
+            rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+            in[k] = rng;
+            sim.set(layout.inputs[k].x(), layout.inputs[k].y(), in[k]);
+        }
+        sim.step(ticks);
+        for (int k = 0; k < out.size(); ++ k)
+            out[k] = sim.get(layout.outputs[k].x(), layout.outputs[k].y());
+        for (int lane = 0; lane < 64; ++ lane) {
+            for (int k = 0; k < in.size(); ++ k)
+                bits[k] = (in[k] >> lane) & 1;
+            const QVector<bool> expected = reference(bits);
+            for (int k = 0; k < out.size(); ++ k)
+                if (((out[k] >> lane) & 1) != (quint64)expected[k])
+                    throw runtime_error(QString("Self-check failed: output %1 is wrong.").arg(k).toStdString());
+        }
+    }
+
+    if (stats) {
+        stats->gates = layout.gates;
+        stats->width = bp.width();
+        stats->height = bp.height();
+        stats->ticks = ticks;
+    }
+
+}
+
+
+// builds, lays out and checks a netlist.
+static Blueprint buildArithmetic (const Netlist &N, const std::function<QVector<bool>(const QVector<bool> &)> &reference, ArithmeticStats *stats) {
+    NetlistLayout layout;
+    Blueprint bp = layoutNetlist(N, &layout);
+    verifyArithmetic(bp, layout, reference, stats);
+    return bp;
+}
+
+
+// (generate, propagate) of a group of bits. propagate is -1 for groups that include the
+// carry in, which never propagate.
+struct CarryGroup {
+    int g, p;
+};
+
+// hi is the more significant group: g = g_hi | (p_hi & g_lo), as a buffer and an and
+// wired together, p = p_hi & p_lo.
+static CarryGroup combine (Netlist &N, CarryGroup hi, CarryGroup lo) {
+    CarryGroup out;
+    out.g = N.gate(Blueprint::Buffer, { hi.g });
+    N.gate(Blueprint::And, { hi.p, lo.g }, out.g);
+    out.p = (lo.p < 0 ? -1 : N.gate(Blueprint::And, { hi.p, lo.p }));
+    return out;
+}
+
+
+Blueprint Adder (int bits, AdderKind kind, ArithmeticStats *stats) {
+
+    if (bits < 1 || bits > 64)
+        throw runtime_error("Adders need 1 to 64 bits.");
+
+    Netlist N;
+    const int cin = N.input();
+    QVector<int> a(bits), b(bits);
+    for (int bit = 0; bit < bits; ++ bit) {
+        N.slice = bit;
+        a[bit] = N.input();
+        b[bit] = N.input();
+    }
+
+    // position 0 is the carry in, position k is bit k-1. after the carry network,
+    // group k covers positions 0..k, i.e. it's the carry into bit k.
+    QVector<int> p(bits);
+    QVector<CarryGroup> group(bits + 1);
+    group[0] = { cin, -1 };
+    for (int bit = 0; bit < bits; ++ bit) {
+        N.slice = bit;
+        p[bit] = N.gate(Blueprint::Xor, { a[bit], b[bit] });
+        group[bit + 1] = { N.gate(Blueprint::And, { a[bit], b[bit] }), p[bit] };
+    }
+    const int positions = bits + 1;
+    const auto combineAt = [&] (int k, int distance) {
+        N.slice = std::max(0, k - 1);
+        group[k] = combine(N, group[k], group[k - distance]);
+    };
+
+    QVector<int> carry(positions);
+
+    switch (kind) {
+    case RippleCarry:
+        for (int k = 1; k < positions; ++ k)
+            combineAt(k, 1);
+        for (int k = 0; k < positions; ++ k)
+            carry[k] = group[k].g;
+        break;
+    case KoggeStone:
+        // every position combines with the one 'distance' below it, log2 levels
+        for (int distance = 1; distance < positions; distance *= 2) {
+            // from the top down, so every combine still sees the previous level below it
+            for (int k = positions - 1; k >= distance; -- k)
+                combineAt(k, distance);
+        }
+        for (int k = 0; k < positions; ++ k)
+            carry[k] = group[k].g;
+        break;
+    case BrentKung: {
+        // up the tree, then back down to fill in the positions that were skipped
+        int distance = 1;
+        for (; distance < positions; distance *= 2)
+            for (int k = 2 * distance - 1; k < positions; k += 2 * distance)
+                combineAt(k, distance);
+        for (distance /= 2; distance >= 1; distance /= 2)
+            for (int k = 3 * distance - 1; k < positions; k += 2 * distance)
+                combineAt(k, distance);
+        for (int k = 0; k < positions; ++ k)
+            carry[k] = group[k].g;
+        break;
+    }
+    case CarrySelect: {
+        // blocks of about sqrt(bits) ripple both ways (carry in 0 and 1) in parallel;
+        // the real carry then picks one per block: c = c0 | (c1 & carry in), which works
+        // because c0 implies c1.
+        const int block = std::max(1, (int)std::ceil(std::sqrt((double)bits)));
+        carry[0] = cin;
+        for (int start = 0; start < bits; start += block) {
+            const int end = std::min(bits, start + block);
+            const int blockin = carry[start];
+            int c0 = -1, c1 = -1;
+            for (int bit = start; bit < end; ++ bit) {
+                N.slice = bit;
+                const int g = group[bit + 1].g;
+                int n0, n1;
+                if (bit == start) {
+                    n0 = g;
+                    n1 = N.gate(Blueprint::Or, { a[bit], b[bit] });
+                } else {
+                    n0 = N.gate(Blueprint::Buffer, { g });
+                    N.gate(Blueprint::And, { p[bit], c0 }, n0);
+                    n1 = N.gate(Blueprint::Buffer, { g });
+                    N.gate(Blueprint::And, { p[bit], c1 }, n1);
+                }
+                c0 = n0;
+                c1 = n1;
+                if (start == 0) {
+                    // the first block has the real carry in already
+                    carry[bit + 1] = N.gate(Blueprint::Buffer, { g });
+                    N.gate(Blueprint::And, { p[bit], carry[bit] }, carry[bit + 1]);
+                } else {
+                    carry[bit + 1] = N.gate(Blueprint::Buffer, { c0 });
+                    N.gate(Blueprint::And, { c1, blockin }, carry[bit + 1]);
+                }
+            }
+        }
+        break;
+    }
+    }
+
+    QVector<int> sum(bits);
+    for (int bit = 0; bit < bits; ++ bit) {
+        N.slice = bit;
+        sum[bit] = N.gate(Blueprint::Xor, { p[bit], carry[bit] });
+    }
+    N.outputs = sum;
+    N.outputs.append(carry[bits]);
+
+    return buildArithmetic(N, [bits] (const QVector<bool> &in) {
+        QVector<bool> out(bits + 1);
+        bool c = in[0];
+        for (int bit = 0; bit < bits; ++ bit) {
+            const bool x = in[1 + 2 * bit], y = in[2 + 2 * bit];
+            out[bit] = x != y != c;
+            c = (x && y) || (c && (x != y));
+        }
+        out[bits] = c;
+        return out;
+    }, stats);
+
+}
+
+
+Blueprint Incrementer (int bits, ArithmeticStats *stats) {
+
+    if (bits < 1 || bits > 64)
+        throw runtime_error("Incrementers need 1 to 64 bits.");
+
+    // the carry into each bit is a single wide and of the bits below it
+    Netlist N;
+    QVector<int> a(bits);
+    for (int bit = 0; bit < bits; ++ bit) {
+        N.slice = bit;
+        a[bit] = N.input();
+    }
+
+    for (int bit = 0; bit < bits; ++ bit) {
+        N.slice = bit;
+        if (bit == 0) {
+            N.outputs.append(N.gate(Blueprint::Not, { a[0] }));
+        } else {
+            const int carry = N.gate(Blueprint::And, a.mid(0, bit));
+            N.outputs.append(N.gate(Blueprint::Xor, { a[bit], carry }));
+        }
+    }
+    N.outputs.append(N.gate(Blueprint::And, a));
+
+    return buildArithmetic(N, [bits] (const QVector<bool> &in) {
+        QVector<bool> out(bits + 1);
+        bool c = true;
+        for (int bit = 0; bit < bits; ++ bit) {
+            out[bit] = in[bit] != c;
+            c = c && in[bit];
+        }
+        out[bits] = c;
+        return out;
+    }, stats);
+
+}
+
+
+Blueprint Comparator (int bits, ArithmeticStats *stats) {
+
+    if (bits < 1 || bits > 64)
+        throw runtime_error("Comparators need 1 to 64 bits.");
+
+    // a < b if at some bit a is 0, b is 1 and every bit above it is equal: one wide and
+    // per bit, all wired together.
+    Netlist N;
+    QVector<int> a(bits), b(bits);
+    for (int bit = 0; bit < bits; ++ bit) {
+        N.slice = bit;
+        a[bit] = N.input();
+        b[bit] = N.input();
+    }
+
+    QVector<int> eq(bits), na(bits), nb(bits);
+    for (int bit = 0; bit < bits; ++ bit) {
+        N.slice = bit;
+        eq[bit] = N.gate(Blueprint::Xnor, { a[bit], b[bit] });
+        na[bit] = N.gate(Blueprint::Not, { a[bit] });
+        nb[bit] = N.gate(Blueprint::Not, { b[bit] });
+    }
+
+    N.slice = bits;
+    const int equal = N.gate(Blueprint::And, eq);
+    int less = -1, greater = -1;
+    for (int bit = bits - 1; bit >= 0; -- bit) {
+        const QVector<int> above = eq.mid(bit + 1);
+        less = N.gate(Blueprint::And, QVector<int>{ na[bit], b[bit] } + above, less);
+        greater = N.gate(Blueprint::And, QVector<int>{ a[bit], nb[bit] } + above, greater);
+    }
+    N.outputs = { equal, less, greater };
+
+    return buildArithmetic(N, [bits] (const QVector<bool> &in) {
+        int result = 0; // -1 less, 1 greater
+        for (int bit = bits - 1; bit >= 0 && !result; -- bit)
+            if (in[2 * bit] != in[2 * bit + 1])
+                result = (in[2 * bit] ? 1 : -1);
+        return QVector<bool>{ result == 0, result < 0, result > 0 };
+    }, stats);
+
+}
+
+
+Blueprint BarrelShifter (int bits, ShifterKind kind, ArithmeticStats *stats) {
+
+    if (bits < 2 || bits > 64)
+        throw runtime_error("Barrel shifters need 2 to 64 bits.");
+
+    int amountBits = 0;
+    while ((1 << amountBits) < bits)
+        ++ amountBits;
+
+    // one stage per shift amount bit, each a 2:1 mux per data bit made of two ands
+    // wired together. the amount (and its inverse) is copied into every bit's slice
+    // by a single gate so the muxes stay local.
+    Netlist N;
+    QVector<int> data(bits), amount(amountBits), slices(bits);
+    QVector<QVector<int>> select(amountBits), nselect(amountBits);
+    for (int bit = 0; bit < bits; ++ bit) {
+        N.slice = slices[bit] = bit;
+        data[bit] = N.input();
+    }
+    N.slice = bits;
+    for (int bit = 0; bit < amountBits; ++ bit)
+        amount[bit] = N.input();
+    for (int bit = 0; bit < amountBits; ++ bit) {
+        select[bit] = N.fanout(Blueprint::Buffer, { amount[bit] }, slices);
+        nselect[bit] = N.fanout(Blueprint::Not, { amount[bit] }, slices);
+    }
+
+    const bool rotate = (kind == RotateLeft || kind == RotateRight);
+    const bool leftward = (kind == ShiftLeft || kind == RotateLeft);
+    for (int stage = 0; stage < amountBits; ++ stage) {
+        const int distance = 1 << stage;
+        QVector<int> next(bits);
+        for (int bit = 0; bit < bits; ++ bit) {
+            int from = (leftward ? bit - distance : bit + distance);
+            if (rotate)
+                from = ((from % bits) + bits) % bits;
+            N.slice = bit;
+            next[bit] = N.gate(Blueprint::And, { data[bit], nselect[stage][bit] });
+            if (from >= 0 && from < bits)
+                N.gate(Blueprint::And, { data[from], select[stage][bit] }, next[bit]);
+        }
+        data = next;
+    }
+    N.outputs = data;
+
+    return buildArithmetic(N, [=] (const QVector<bool> &in) {
+        int shift = 0;
+        for (int bit = 0; bit < amountBits; ++ bit)
+            shift |= (in[bits + bit] ? 1 : 0) << bit;
+        QVector<bool> out(bits);
+        for (int bit = 0; bit < bits; ++ bit) {
+            int from = (leftward ? bit - shift : bit + shift);
+            if (rotate)
+                from = ((from % bits) + bits) % bits;
+            out[bit] = (from >= 0 && from < bits) && in[from];
+        }
+        return out;
+    }, stats);
+
+}
+
+
+BitmapFont::BitmapFont () : width_(0), height_(0), kerning_(0), lowercase_(false), lut_(256, -1) {
+}
+
+
+BitmapFont::BitmapFont (const QImage &image, const QString &charset, int kerning)
+    : width_(0), height_(0), kerning_(kerning), lowercase_(false), lut_(256, -1)
+{
+
+    qDebug().noquote() << charset;
+
+    const QByteArray chars = charset.toLatin1();
+    if (chars.isEmpty() || image.width() % chars.length() != 0)
         throw runtime_error("font image width does not match character set length");
 
-    const QByteArray str = (charset.contains('a') ? text.toLatin1() : text.toUpper().toLatin1());
+    width_ = image.width() / chars.length();
+    height_ = image.height();
+    if (width_ > 64)
+        throw runtime_error("font characters can't be wider than 64 pixels");
+    lowercase_ = chars.contains('a');
 
-    font = font.convertToFormat(QImage::Format_RGB888);
+    // rgb888 is r,g,b bytes. first definition of a character wins, like strchr did.
+    const QImage sheet = image.convertToFormat(QImage::Format_RGB888);
+    rows_.resize(chars.length() * height_);
+    for (int y = 0; y < height_; ++ y) {
+        const uchar *line = sheet.constScanLine(y);
+        for (int index = 0; index < chars.length(); ++ index) {
+            quint64 bits = 0;
+            for (int cx = 0; cx < width_; ++ cx)
+                if (line[3 * (index * width_ + cx)] < 128)
+                    bits |= (1ULL << cx);
+            rows_[index * height_ + y] = bits;
+        }
+    }
+    for (int index = chars.length() - 1; index >= 0; -- index)
+        lut_[(uchar)chars[index]] = index;
+
+}
 
-    const int charwidth = font.width() / charsetlen;
-    const int charheight = font.height();
-    const int bpwidth = (charwidth + 1 + kerning) * str.size();
-    const int bpheight = charheight;
+
+Blueprint Text (QImage font, QString fontCharset, int kerning, QString text, Blueprint::Ink logicInk, Blueprint::Ink decoOnInk, Blueprint::Ink decoOffInk) {
+
+    return Text(BitmapFont(font, fontCharset, kerning), text, logicInk, decoOnInk, decoOffInk);
+
+}
+
+
+// splits text into lines per TextLayout, measuring with width(). greedy: each word goes
+// on the current line if it fits.
+static QStringList wrapLines (const QString &text, int wrapWidth, const std::function<int(const QString &)> &width) {
+
+    QStringList lines;
+
+    for (const QString &paragraph : text.split('\n')) {
+        if (wrapWidth <= 0) {
+            lines.append(paragraph);
+            continue;
+        }
+        QString line;
+        bool started = false; // line has a word on it (which may be empty, for runs of spaces)
+        for (QString word : paragraph.split(' ')) {
+            // words too long for a line on their own are split
+            while (word.size() > 1 && width(word) > wrapWidth) {
+                int fits = word.size() - 1;
+                while (fits > 1 && width(word.left(fits)) > wrapWidth)
+                    -- fits;
+                if (started)
+                    lines.append(line);
+                lines.append(word.left(fits));
+                word = word.mid(fits);
+                line.clear();
+                started = false;
+            }
+            const QString joined = (started ? line + ' ' + word : word);
+            if (!started || width(joined) <= wrapWidth) {
+                line = joined;
+            } else {
+                lines.append(line);
+                line = word;
+            }
+            started = true;
+        }
+        lines.append(line);
+    }
+
+    return lines;
+
+}
+
+
+static int alignOffset (Qt::Alignment alignment, int lineWidth, int blockWidth) {
+    if (alignment & Qt::AlignRight)
+        return blockWidth - lineWidth;
+    else if (alignment & Qt::AlignHCenter)
+        return (blockWidth - lineWidth) / 2;
+    else
+        return 0;
+}
+
+
+Blueprint Text (const BitmapFont &font, QString text, Blueprint::Ink logicInk, Blueprint::Ink decoOnInk, Blueprint::Ink decoOffInk, const TextLayout &layout) {
+
+    if (font.isNull())
+        throw runtime_error("font not loaded");
+
+    if (!font.hasLowercase())
+        text = text.toUpper();
+
+    // every character, including the last on a line, takes up a full advance.
+    const int charwidth = font.glyphWidth();
+    const int charheight = font.glyphHeight();
+    const int advance = charwidth + 1 + font.kerning();
+    const QStringList lines = wrapLines(text, layout.wrapWidth, [advance] (const QString &line) {
+        return line.size() * advance;
+    });
+
+    int bpwidth = 0;
+    for (const QString &line : lines)
+        bpwidth = std::max(bpwidth, line.size() * advance);
+    const int bpheight = lines.size() * charheight + (lines.size() - 1) * layout.lineSpacing;
+
+    // glyph rows and position of every character, undefined ones dropped
+    struct Placed {
+        const quint64 *rows;
+        int x, y;
+        quint64 clip; // columns that fit in the blueprint
+    };
+    QVector<Placed> placed;
+    for (int l = 0; l < lines.size(); ++ l) {
+        const QByteArray str = lines[l].toLatin1();
+        const int x0 = alignOffset(layout.alignment, str.size() * advance, bpwidth);
+        const int y = l * (charheight + layout.lineSpacing);
+        for (int k = 0; k < str.size(); ++ k) {
+            const quint64 *rows = font.glyph((uchar)str[k]);
+            if (!rows) { qDebug() << "skipping undefined character" << str[k]; continue; }
+            const int x = x0 + k * advance;
+            const int room = bpwidth - x;
+            if (room <= 0)
+                continue;
+            placed.append(Placed{ rows, x, y, room >= 64 ? ~0ULL : ((1ULL << room) - 1) });
+        }
+    }
 
     QVector<QPair<Blueprint::Layer,Blueprint::Ink> > layerInks;
     layerInks.append({Blueprint::Logic, logicInk});
     layerInks.append({Blueprint::DecoOn, decoOnInk});
     layerInks.append({Blueprint::DecoOff, decoOffInk});
 
-    Blueprint *bp = new Blueprint(bpwidth, bpheight);
-
-    for (int k = 0; k < str.size(); ++ k) {
-        const char ch = str[k];
-        const char *chloc = strchr(charset, ch);
-        if (!chloc) { qDebug() << "skipping undefined character" << ch; continue; }
-        const int index = chloc - charset;
-        const int srcx0 = index * charwidth;
-        const int dstx0 = k * (charwidth + 1 + kerning);
-        for (auto layerInk : layerInks) {
-            const Blueprint::Layer layer = layerInk.first;
-            const Blueprint::Ink ink = layerInk.second;
-            if (!ink.isValid())
-                continue;
+    Blueprint bp(bpwidth, bpheight);
+
+    for (auto layerInk : layerInks) {
+        if (!layerInk.second.isValid())
+            continue;
+        const quint32 raw = Blueprint::RawInk(layerInk.second);
+        for (const Placed &p : placed) {
             for (int cy = 0; cy < charheight; ++ cy) {
-                for (int cx = 0; cx < charwidth; ++ cx) {
-                    const int srcx = srcx0 + cx;
-                    const int srcy = cy;
-                    const int dstx = dstx0 + cx;
-                    const int dsty = cy;
-                    QRgb srcpix = font.pixel(srcx, srcy);
-                    if (qRed(srcpix) < 128) bp->setPixel(layer, dstx, dsty, ink);
-                }
+                quint32 *dst = bp.scanLine(layerInk.first, p.y + cy) + p.x;
+                for (quint64 bits = p.rows[cy] & p.clip; bits; bits &= bits - 1)
+                    dst[qCountTrailingZeroBits(bits)] = raw;
             }
         }
     }
@@ -196,47 +1897,190 @@ Blueprint * Text (QImage font, QString fontCharset, int kerning, QString text, B
 }
 
 
-Blueprint * Text (QFont font, int fontHeight, QString text, Blueprint::Ink logicInk, Blueprint::Ink decoOnInk, Blueprint::Ink decoOffInk) {
+SystemFontCache::Glyph SystemFontCache::glyph (const QFont &font, const QString &text) {
 
-    // === generate font image ===
+    QMutexLocker lock(&mutex_);
 
-    font.setPixelSize(fontHeight);
-    font.setStyleStrategy(QFont::NoAntialias);
-    font.setHintingPreference(QFont::PreferFullHinting);
-
-    QRect rcText = QFontMetrics(font).boundingRect(text);
-    QImage textImage(rcText.size(), QImage::Format_RGB888);
+    const QString key = font.toString() + QChar(0) + text;
+    if (const Glyph *cached = glyphs_.object(key))
+        return *cached;
 
+    // draw it with enough room around the pen for overhangs, then collect the runs
+    const QFontMetrics metrics(font);
+    Glyph glyph;
+    glyph.advance = metrics.horizontalAdvance(text);
+    const int pad = metrics.height();
+    QImage image(glyph.advance + 2 * pad, metrics.height(), QImage::Format_RGB888);
     {
-        QPainter p(&textImage);
+        QPainter p(&image);
         p.setRenderHint(QPainter::Antialiasing, false);
         p.setRenderHint(QPainter::TextAntialiasing, false);
-        p.fillRect(textImage.rect(), Qt::black);
+        p.fillRect(image.rect(), Qt::black);
         p.setPen(Qt::white);
         p.setFont(font);
-        p.drawText(textImage.rect(), Qt::AlignHCenter | Qt::AlignVCenter | Qt::TextSingleLine, text);
+        p.drawText(QPoint(pad, metrics.ascent()), text);
     }
 
-    //textImage.save("debug-fontimage.png");
+    glyph.left = glyph.advance;
+    glyph.right = 0;
+    for (int y = 0; y < image.height(); ++ y) {
+        const uchar *src = image.constScanLine(y);
+        for (int x = 0; x < image.width(); ++ x) {
+            if (src[3 * x] <= 128)
+                continue;
+            int end = x;
+            while (end < image.width() && src[3 * end] > 128)
+                ++ end;
+            glyph.runs.append(Run{ x - pad, y, end - x });
+            glyph.left = std::min(glyph.left, x - pad);
+            glyph.right = std::max(glyph.right, end - pad);
+            x = end;
+        }
+    }
+    if (glyph.runs.isEmpty())
+        glyph.left = 0;
+
+    glyphs_.insert(key, new Glyph(glyph), glyph.runs.size() + 1);
+    return glyph;
+
+}
 
-    // === now copy it to every layer ===
+
+// what a line is drawn as: its grapheme clusters, so base characters keep their
+// combining marks and surrogate pairs stay together, or the whole line if it needs a
+// fallback font, shaping across clusters or right-to-left ordering, which drawing
+// clusters one at a time loses. whole is set in that case.
+static QStringList textPieces (const QFontMetrics &metrics, const QString &line, bool *whole = nullptr) {
+
+    if (whole)
+        *whole = true;
+
+    for (int i = 0; i < line.size(); ++ i) {
+        uint ucs4 = line[i].unicode();
+        if (line[i].isHighSurrogate() && i + 1 < line.size() && line[i + 1].isLowSurrogate())
+            ucs4 = QChar::surrogateToUcs4(line[i], line[i + 1]), ++ i;
+        switch (QChar::script(ucs4)) {
+        case QChar::Script_Common: case QChar::Script_Inherited:
+        case QChar::Script_Latin: case QChar::Script_Greek: case QChar::Script_Cyrillic:
+        case QChar::Script_Armenian: case QChar::Script_Georgian:
+        case QChar::Script_Han: case QChar::Script_Hiragana: case QChar::Script_Katakana:
+        case QChar::Script_Hangul: case QChar::Script_Bopomofo:
+            break;
+        default:
+            return { line };
+        }
+        if (!QChar::isSpace(ucs4) && !metrics.inFontUcs4(ucs4))
+            return { line };
+    }
+
+    if (whole)
+        *whole = false;
+    QStringList clusters;
+    QTextBoundaryFinder finder(QTextBoundaryFinder::Grapheme, line);
+    int start = 0;
+    for (int end = finder.toNextBoundary(); end > 0; end = finder.toNextBoundary()) {
+        clusters.append(line.mid(start, end - start));
+        start = end;
+    }
+    return clusters;
+
+}
+
+
+Blueprint Text (QFont font, int fontHeight, QString text, Blueprint::Ink logicInk, Blueprint::Ink decoOnInk, Blueprint::Ink decoOffInk, const TextLayout &layout, SystemFontCache *cache, const std::function<bool()> &cancelled) {
+
+    const auto isCancelled = [&] () { return cancelled && cancelled(); };
+
+    font.setPixelSize(fontHeight);
+    font.setStyleStrategy(QFont::NoAntialias);
+    font.setHintingPreference(QFont::PreferFullHinting);
+
+    SystemFontCache localCache;
+    if (!cache)
+        cache = &localCache;
+
+    const QFontMetrics metrics(font);
+    const QStringList lines = wrapLines(text, layout.wrapWidth, [&] (const QString &line) {
+        bool whole;
+        const QStringList pieces = textPieces(metrics, line, &whole);
+        if (whole) // don't render every candidate line just to measure it
+            return metrics.horizontalAdvance(line);
+        int width = 0;
+        for (const QString &piece : pieces)
+            width += cache->glyph(font, piece).advance;
+        return width;
+    });
+
+    // === place glyphs: pen positions within each line, then the lines within the block ===
+
+    struct Placed {
+        SystemFontCache::Glyph glyph;
+        int x, y;
+    };
+    struct Line {
+        QVector<Placed> glyphs;
+        int left, right; // ink and advance extent
+    };
+
+    const int lineHeight = metrics.height();
+    QVector<Line> placedLines;
+    int imageWidth = 0;
+    for (const QString &str : lines) {
+        if (isCancelled())
+            return Blueprint();
+        Line line = { {}, 0, 0 };
+        int pen = 0;
+        for (const QString &piece : textPieces(metrics, str)) {
+            const SystemFontCache::Glyph glyph = cache->glyph(font, piece);
+            if (!glyph.runs.isEmpty()) {
+                line.glyphs.append(Placed{ glyph, pen, 0 });
+                line.left = std::min(line.left, pen + glyph.left);
+                line.right = std::max(line.right, pen + glyph.right);
+            }
+            pen += glyph.advance;
+        }
+        line.right = std::max(line.right, pen);
+        imageWidth = std::max(imageWidth, line.right - line.left);
+        placedLines.append(line);
+    }
+    const int imageHeight = lines.size() * lineHeight + (lines.size() - 1) * layout.lineSpacing;
+
+    for (int l = 0; l < placedLines.size(); ++ l) {
+        Line &line = placedLines[l];
+        const int x0 = alignOffset(layout.alignment, line.right - line.left, imageWidth) - line.left;
+        for (Placed &placed : line.glyphs) {
+            placed.x += x0;
+            placed.y = l * (lineHeight + layout.lineSpacing);
+        }
+    }
+
+    // === copy runs to every layer ===
 
     QVector<QPair<Blueprint::Layer,Blueprint::Ink> > layerInks;
     layerInks.append({Blueprint::Logic, logicInk});
     layerInks.append({Blueprint::DecoOn, decoOnInk});
     layerInks.append({Blueprint::DecoOff, decoOffInk});
 
-    Blueprint *bp = new Blueprint(textImage.width(), textImage.height());
+    Blueprint bp(imageWidth, imageHeight);
 
     for (auto layerInk : layerInks) {
-        const Blueprint::Layer layer = layerInk.first;
-        const Blueprint::Ink ink = layerInk.second;
-        if (!ink.isValid())
+        if (!layerInk.second.isValid())
             continue;
-        for (int y = 0; y < textImage.height(); ++ y) {
-            for (int x = 0; x < textImage.width(); ++ x) {
-                QRgb srcpix = textImage.pixel(x, y);
-                if (qRed(srcpix) > 128) bp->setPixel(layer, x, y, ink);
+        if (isCancelled()) {
+            return Blueprint();
+        }
+        const quint32 raw = Blueprint::RawInk(layerInk.second);
+        for (const Line &line : placedLines) {
+            for (const Placed &placed : line.glyphs) {
+                for (const SystemFontCache::Run &run : placed.glyph.runs) {
+                    const int y = placed.y + run.y;
+                    const int x0 = std::max(0, placed.x + run.x);
+                    const int x1 = std::min(imageWidth, placed.x + run.x + run.length);
+                    if (y < 0 || y >= imageHeight || x0 >= x1)
+                        continue;
+                    quint32 *dst = bp.scanLine(layerInk.first, y);
+                    std::fill(dst + x0, dst + x1, raw);
+                }
             }
         }
     }
@@ -2,15 +2,142 @@
 #define CIRCUITS_H
 
 #include "blueprint.h"
+#include <QCache>
+#include <QFont>
+#include <QMutex>
+#include <functional>
 
 namespace Circuits {
 
 enum ROMDataLSBSide { Bottom=0, Top=1 };
 enum ROMAddress0Side { Near=0, Far=1 };
 
-Blueprint * ROM (int addressBits, int dataBits, ROMDataLSBSide dataLSB, ROMAddress0Side addr0Side, const QVector<quint64> &data, bool omitEmpty);
-Blueprint * Text (QImage font, QString fontCharset, int kerning, QString text, Blueprint::Ink logicInk = Blueprint::Annotation, Blueprint::Ink decoOnInk = Blueprint::Invalid, Blueprint::Ink decoOffInk = Blueprint::Invalid);
-Blueprint * Text (QFont font, int fontHeight, QString text, Blueprint::Ink logicInk, Blueprint::Ink decoOnInk, Blueprint::Ink decoOffInk);
+// size of a generated ROM or PLA; reads and writes only count the ones in the gate columns.
+struct ROMStats {
+    int gates;
+    int reads;
+    int writes;
+    int width;
+    int height;
+    int ticks;
+    ROMStats () : gates(0), reads(0), writes(0), width(0), height(0), ticks(0) { }
+};
+
+Blueprint ROM (int addressBits, int dataBits, ROMDataLSBSide dataLSB, ROMAddress0Side addr0Side, const QVector<quint64> &data, bool omitEmpty);
+// same inputs and outputs as an omitEmpty ROM, but with one column per product term of a
+// minimized sum-of-products instead of one per address. romStats gets the size the classic
+// ROM would have been for comparison.
+Blueprint PLA (int addressBits, int dataBits, ROMDataLSBSide dataLSB, const QVector<quint64> &data, ROMStats *stats = nullptr, ROMStats *romStats = nullptr);
+// a rom split into 2^k banks stacked vertically, k chosen so width/height is close to
+// aspect. the high address bits are predecoded into a select line per bank and the banks
+// share one output bus per data bit. address 0 is on the input side. the result is
+// simulated before it's returned and an exception is thrown if it reads back wrong.
+Blueprint BankedROM (int addressBits, int dataBits, ROMDataLSBSide dataLSB, const QVector<quint64> &data, double aspect, ROMStats *stats = nullptr);
+// size and timing of a generated RAM. latencies are ticks from the address and write
+// enable inputs changing to the output (read) or the storage latch (write) updating.
+struct RAMStats {
+    int gates;
+    int latches;
+    int width;
+    int height;
+    int readTicks;
+    int writeTicks;
+    RAMStats () : gates(0), latches(0), width(0), height(0), readTicks(0), writeTicks(0) { }
+};
+
+// a register file with one toggle latch per bit and a rom style decoder per port. every
+// generated ram is simulated before it's returned and an exception is thrown if any port
+// misbehaves.
+Blueprint RAM (int addressBits, int dataBits, int readPorts, int writePorts, RAMStats *stats = nullptr);
+// size and depth of a generated arithmetic circuit. ticks is the longest path from any
+// input to any output.
+struct ArithmeticStats {
+    int gates;
+    int width;
+    int height;
+    int ticks;
+    ArithmeticStats () : gates(0), width(0), height(0), ticks(0) { }
+};
+
+enum AdderKind { RippleCarry=0, KoggeStone=1, BrentKung=2, CarrySelect=3 };
+enum ShifterKind { ShiftLeft=0, ShiftRight=1, RotateLeft=2, RotateRight=3 };
+
+// combinational arithmetic, inputs on the left edge and outputs on the right edge, one
+// bit per slice from the top. every generated circuit is simulated against a reference
+// before it's returned and an exception is thrown if its results or its depth are off.
+// inputs cin, a0, b0, a1, b1, ...; outputs s0, s1, ..., cout.
+Blueprint Adder (int bits, AdderKind kind, ArithmeticStats *stats = nullptr);
+// inputs a0, a1, ...; outputs a+1 and the carry out. always 2 ticks.
+Blueprint Incrementer (int bits, ArithmeticStats *stats = nullptr);
+// inputs a0, b0, a1, b1, ...; outputs a==b, a<b, a>b (unsigned). always 2 ticks.
+Blueprint Comparator (int bits, ArithmeticStats *stats = nullptr);
+// inputs d0, d1, ..., then the shift amount, lsb first; outputs the shifted data.
+Blueprint BarrelShifter (int bits, ShifterKind kind, ArithmeticStats *stats = nullptr);
+// a built-in font sheet (one row of equal width glyphs, dark = ink) thresholded into
+// 1-bit glyph rows, with a latin-1 lookup table instead of searching the charset. meant
+// to be built once per font and reused for every Text() call.
+class BitmapFont {
+public:
+    BitmapFont ();
+    BitmapFont (const QImage &image, const QString &charset, int kerning);
+    bool isNull () const { return rows_.isEmpty(); }
+    int glyphWidth () const { return width_; }
+    int glyphHeight () const { return height_; }
+    int kerning () const { return kerning_; }
+    bool hasLowercase () const { return lowercase_; }
+    // rows of a character, bit x set where there's ink. nullptr if the font doesn't have it.
+    const quint64 * glyph (uchar ch) const { return lut_[ch] < 0 ? nullptr : rows_.constData() + lut_[ch] * height_; }
+private:
+    int width_;
+    int height_;
+    int kerning_;
+    bool lowercase_;
+    QVector<int> lut_;       // latin-1 code -> glyph index, -1 if undefined
+    QVector<quint64> rows_;  // height_ rows per glyph
+};
+
+// how Text() lays out multiple lines. lines break at '\n' and, if wrapWidth is set,
+// between words so no line is wider than wrapWidth pixels (a word that's too long on its
+// own is split). lines are aligned within the widest one.
+struct TextLayout {
+    int wrapWidth; // 0 = don't wrap
+    Qt::Alignment alignment; // AlignLeft, AlignHCenter or AlignRight
+    int lineSpacing; // empty rows between lines
+    TextLayout () : wrapWidth(0), alignment(Qt::AlignLeft), lineSpacing(1) { }
+};
+
+// system font text rendered once per (font, pixel size, grapheme cluster) as runs of lit
+// pixels, so repeated characters are copied instead of drawn. least recently used
+// entries are dropped once the cache holds MaxRuns runs. safe to share between threads.
+class SystemFontCache {
+public:
+    static constexpr int MaxRuns = 1 << 18;
+    SystemFontCache () : glyphs_(MaxRuns) { }
+    struct Run {
+        int x, y, length; // x relative to the pen position, y from the top of the line
+    };
+    struct Glyph {
+        int advance;
+        int left, right; // horizontal ink extent relative to the pen position
+        QVector<Run> runs;
+        Glyph () : advance(0), left(0), right(0) { }
+    };
+    // font must already have its pixel size and render options set. text is drawn in one
+    // go, so it can be a whole cluster or line that needs shaping.
+    Glyph glyph (const QFont &font, const QString &text);
+private:
+    QMutex mutex_;
+    QCache<QString,Glyph> glyphs_; // by QFont::toString() and text, cost is the run count
+};
+
+Blueprint Text (const BitmapFont &font, QString text, Blueprint::Ink logicInk = Blueprint::Annotation, Blueprint::Ink decoOnInk = Blueprint::Invalid, Blueprint::Ink decoOffInk = Blueprint::Invalid, const TextLayout &layout = TextLayout());
+Blueprint Text (QImage font, QString fontCharset, int kerning, QString text, Blueprint::Ink logicInk = Blueprint::Annotation, Blueprint::Ink decoOnInk = Blueprint::Invalid, Blueprint::Ink decoOffInk = Blueprint::Invalid);
+// grapheme clusters are placed at their advance widths (no pair kerning). lines with
+// characters the font doesn't have, or in scripts that are shaped across clusters
+// (arabic, indic, ...), are drawn whole so font fallback and shaping still apply.
+// cancelled is polled while laying out and drawing; if it returns true nothing is
+// generated and the result is a null blueprint.
+Blueprint Text (QFont font, int fontHeight, QString text, Blueprint::Ink logicInk, Blueprint::Ink decoOnInk, Blueprint::Ink decoOffInk, const TextLayout &layout = TextLayout(), SystemFontCache *cache = nullptr, const std::function<bool()> &cancelled = nullptr);
 
 }
 
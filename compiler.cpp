@@ -2,8 +2,14 @@
 #include <stdexcept>
 #include <QSet>
 #include <QMap>
+#include <QHash>
 #include <QDebug>
 #include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <queue>
+#include <algorithm>
 
 using std::runtime_error;
 
@@ -37,22 +43,72 @@ void Compiler::compileBlueprint (const Blueprint *bp) {
     const int width = bp->width();
     const int height = bp->height();
 
-    const auto index = [&width] (int x, int y) {
-        return y * width + x;
+    // --- initialize
+
+    // the passes below only look at tiles with ink in them: every TileSize square tile in
+    // use gets a slot, and pixels are indexed by slot, so a big mostly empty blueprint
+    // doesn't cost a component and a union-find entry per pixel. pixels in tiles without
+    // a slot are empty. entity ids are still pixel indices (y * width + x).
+    const int TileSize = Blueprint::TileSize, TileArea = TileSize * TileSize;
+    const int tilesX = (width + TileSize - 1) / TileSize;
+    const int tilesY = (height + TileSize - 1) / TileSize;
+    QVector<int> tileSlot(tilesX * tilesY, -1);
+    QVector<int> slotTile; // slot => tile
+
+    const auto index = [&] (int x, int y) { // -1 in tiles without a slot
+        const int slot = tileSlot[(y / TileSize) * tilesX + x / TileSize];
+        return slot < 0 ? -1 : slot * TileArea + (y % TileSize) * TileSize + x % TileSize;
     };
 
-    // --- initialize
+    const auto pixelIndex = [&] (int id) {
+        const int tile = slotTile[id / TileArea], offset = id % TileArea;
+        const int x = (tile % tilesX) * TileSize + offset % TileSize;
+        const int y = (tile / tilesX) * TileSize + offset / TileSize;
+        return y * width + x;
+    };
 
-    // translate qcolors to compiler component ids
-    QVector<QVector<Component> > logic(height);
+    // translate qcolors to compiler component ids, reading raw spans and skipping empty
+    // ones (e.g. empty tiles). neighbouring pixels are usually the same ink, so the last
+    // lookup is reused.
+    const quint32 rawEmpty = Blueprint::RawInk(Blueprint::Empty);
+    const Component empty = Comp(Blueprint::Empty);
+    QVector<Component> logic;
     for (int y = 0; y < height; ++ y) {
-        logic[y] = QVector<Component>(width);
-        for (int x = 0; x < width; ++ x)
-            logic[y][x] = Comp(bp->get(x, y));
+        quint32 lastRaw = rawEmpty;
+        Component last = empty;
+        for (int x = 0; x < width; ) {
+            int length;
+            const quint32 *span = bp->constSpan(Blueprint::Logic, x, y, &length);
+            length = std::min(length, TileSize - x % TileSize); // dense spans cross tiles
+            const quint32 *ink = span ? std::find_if(span, span + length, [rawEmpty] (quint32 raw) { return raw != rawEmpty; }) : nullptr;
+            if (ink && ink != span + length) {
+                int &slot = tileSlot[(y / TileSize) * tilesX + x / TileSize];
+                if (slot < 0) {
+                    slot = slotTile.size();
+                    slotTile.append((y / TileSize) * tilesX + x / TileSize);
+                    logic.resize(logic.size() + TileArea);
+                    std::fill(logic.end() - TileArea, logic.end(), empty);
+                }
+                Component *out = logic.data() + index(x, y);
+                for (int k = ink - span; k < length; ++ k) {
+                    if (span[k] != lastRaw) {
+                        lastRaw = span[k];
+                        last = Comp(Blueprint::InkFromRaw(lastRaw));
+                    }
+                    out[k] = last;
+                }
+            }
+            x += length;
+        }
     }
 
+    const auto at = [&] (int x, int y) {
+        const int id = index(x, y);
+        return id < 0 ? empty : logic[id];
+    };
+
     // initially, every pixel has a unique id
-    QVector<int> comps(width * height);
+    QVector<int> comps(logic.size());
     for (int k = 0; k < comps.size(); ++ k)
         comps[k] = k;
 
@@ -73,8 +129,8 @@ void Compiler::compileBlueprint (const Blueprint *bp) {
 
     const auto checkPass1 = [&] (int px, int py, int nx, int ny) {
         // merge pixels into an entity
-        Component p = logic[py][px], n = logic[ny][nx];
-        if (Same(p, n)) unite(comps, index(px, py), index(nx, ny));
+        Component p = at(px, py), n = at(nx, ny);
+        if (!IsEmpty(p) && Same(p, n)) unite(comps, index(px, py), index(nx, ny));
         // note bus/tunnel/mesh connections
         QPoint qp(px, py), qn(nx, ny);
         addConn(p, n, qp, qn, busConns, IsBus);
@@ -90,24 +146,30 @@ void Compiler::compileBlueprint (const Blueprint *bp) {
 
     const auto uniteCross = [&] (int ax, int ay, int bx, int by) {
         if (!(outside(ax, width) || outside(ay, height) || outside(bx, width) || outside(by, height))) {
-            Component a = logic[ay][ax], b = logic[by][bx];
-            if (Same(a, b)) unite(comps, index(ax, ay), index(bx, by));
+            Component a = at(ax, ay), b = at(bx, by);
+            if (!IsEmpty(a) && Same(a, b)) unite(comps, index(ax, ay), index(bx, by));
         }
     };
 
-    // build initial connected components
+    // build initial connected components in row order, which decides the root pixels and
+    // so the entity ids, skipping tiles without a slot. a pixel next to such a tile only
+    // pairs with empty pixels there, which does nothing.
     for (int y = 0; y < height; ++ y) {
         for (int x = 0; x < width; ++ x) {
+            if (index(x, y) < 0) {
+                x += TileSize - 1 - x % TileSize;
+                continue;
+            }
             // merge neighbors
             if (x < width - 1) checkPass1(x, y, x+1, y);
             if (y < height - 1) checkPass1(x, y, x, y+1);
             // merge across crosses
-            if (IsCross(logic[y][x])) {
+            if (IsCross(at(x, y))) {
                 uniteCross(x-1, y, x+1, y);
                 uniteCross(x, y-1, x, y+1);
             }
             // merge all global components
-            Component p = logic[y][x];
+            Component p = at(x, y);
             if (IsWifi(p)) {
                 int channel = WirelessIndex(p);
                 if (wirelessRoot[channel] == -1)
@@ -140,9 +202,7 @@ void Compiler::compileBlueprint (const Blueprint *bp) {
     };  
 
     const auto type = [&] (int compid) {
-        int x = compid % width;
-        int y = compid / width;
-        return logic[y][x];
+        return logic[compid];
     };
 
     const auto uniteGroup = [&] (const QVector<int> &group) {
@@ -168,7 +228,7 @@ void Compiler::compileBlueprint (const Blueprint *bp) {
         for (const Conn &conn : tunnelConns) {
             QPoint tp = conn.first;
             QPoint pp = conn.second;
-            Component startp = logic[pp.y()][pp.x()];
+            Component startp = at(pp.x(), pp.y());
             if (IsMesh(startp)) continue; // meshes don't go through tunnels
             int dx = tp.x() - pp.x(), dy = tp.y() - pp.y();
             assert(dx >= -1 && dx <= 1);
@@ -182,8 +242,8 @@ void Compiler::compileBlueprint (const Blueprint *bp) {
                 y += dy;
                 if (dx && (x <= 0 || x >= width - 1)) break;
                 if (dy && (y <= 0 || y >= height - 1)) break;
-                Component endt = logic[y][x];
-                Component endp = logic[y+dy][x+dx];
+                Component endt = at(x, y);
+                Component endp = at(x+dx, y+dy);
                 if (IsTunnel(endt) && endp == startp) {
                     unite(comps, index(pp.x(), pp.y()), index(x+dx, y+dy));
                     matched = true;
@@ -234,14 +294,14 @@ void Compiler::compileBlueprint (const Blueprint *bp) {
     for (int id : comps) {
         Component t = type(id);
         if (IsActive(t) || IsTrace(t))
-            sgraph_.entities[id] = t;
+            sgraph_.entities[pixelIndex(id)] = t;
     }
 
     // read connections
     for (const Conn &conn : readConns) {
         if (IsActive(type(indexq(conn.second)))) {
-            int from = findp(conn.first);
-            int to = findp(conn.second);
+            int from = pixelIndex(findp(conn.first));
+            int to = pixelIndex(findp(conn.second));
             sgraph_.connections.insert({from, to});
         }
     }
@@ -249,12 +309,17 @@ void Compiler::compileBlueprint (const Blueprint *bp) {
     // write connections
     for (const Conn &conn : writeConns) {
         if (IsActive(type(indexq(conn.second)))) {
-            int from = findp(conn.second);
-            int to = findp(conn.first);
+            int from = pixelIndex(findp(conn.second));
+            int to = pixelIndex(findp(conn.first));
             sgraph_.connections.insert({from, to});
         }
     }
 
+    for (int &id : comps)
+        id = pixelIndex(id);
+    pixels_ = comps;
+    tileSlots_ = tileSlot;
+
     // --- debugging:
 
     qint64 nsecs = timer.nsecsElapsed();
@@ -479,7 +544,7 @@ Compiler::GraphResults Compiler::buildGraphViz (GraphSettings settings) const {
     ComplexGraph cgraph = buildComplexGraph(graph);
 
     if (settings.timings || settings.timinglabels)
-        results.stats = computeTimings(cgraph);
+        results.stats = computeTimings(cgraph, settings.timing);
 
     for (int id : graph.entities.keys()) {
 
@@ -582,6 +647,409 @@ Compiler::GraphResults Compiler::buildGraphViz (GraphSettings settings) const {
 }
 
 
+Compiler::SimOp Compiler::SimOpFor (Component type) {
+
+    switch (type) {
+    case And: return OpAll;
+    case Nand: return OpNotAll;
+    case Nor: case Not: return OpNotAny;
+    case Xor: return OpOdd;
+    case Xnor: return OpNotOdd;
+    case Clock: return OpClock;
+    case Timer: return OpTimer;
+    case Random: return OpRandom;
+    case LatchOn: case LatchOff: return OpLatch; // toggles on the rising edge of its input
+    default: return OpAny; // traces, buffers, ors, leds, breaks, wireless
+    }
+
+}
+
+
+Compiler::SimNetwork Compiler::buildSimNetwork (const SimpleGraph &graph) {
+
+    SimNetwork net;
+    net.exts = 0;
+    net.latches = 0;
+
+    QVector<QVector<int> > inputs;
+    for (auto e = graph.entities.cbegin(); e != graph.entities.cend(); ++ e) {
+        net.slots[e.key()] = net.nodes.size();
+        net.nodes.append(SimNetwork::Slot{ e.value(), SimOpFor(e.value()), 0, 0, 0, -1, -1 });
+        inputs.append(QVector<int>());
+    }
+    for (const QPair<int,int> &conn : graph.connections)
+        inputs[net.slots[conn.second]].append(net.slots[conn.first]);
+
+    // inputs are packed into one array so stepping doesn't chase pointers
+    for (int k = 0; k < net.nodes.size(); ++ k) {
+        SimNetwork::Slot &node = net.nodes[k];
+        node.first = net.from.size();
+        node.count = inputs[k].size();
+        net.from += inputs[k];
+        if (IsTrace(node.type)) {
+            node.index = net.traces.size();
+            net.traces.append(k);
+            if (node.count == 0)
+                node.ext = net.exts ++;
+        } else {
+            node.index = net.gates.size();
+            net.gates.append(k);
+            if (node.op == OpLatch)
+                node.latch = net.latches ++;
+        }
+    }
+
+    return net;
+
+}
+
+
+// generates a self-contained c++ simulator for the circuit. every signal is a 64-bit
+// word so each bit is an independent copy of the circuit ("lane"). gate states are
+// double buffered, so each tick is just straight-line code: settle the traces from the
+// current gate states, compute every next gate state, swap. loops need no special
+// handling since nothing ever reads a value computed during the same tick.
+Compiler::SimResults Compiler::buildSimulator (SimSettings settings) const {
+
+    SimResults results;
+
+    // traces get slots in t[], everything else gets slots in s[]. input traces also
+    // get a slot in x[] (external value set via the api), latches get a slot in l[]
+    // (previous input, for edge detection).
+    const SimpleGraph graph = compressedConnections();
+    const SimNetwork net = buildSimNetwork(graph);
+
+    ComplexGraph cgraph = buildComplexGraph(graph);
+    QVector<const Node *> ports;
+    for (const Node *node : cgraph.values())
+        if (node->purpose != Node::Other)
+            ports.append(node);
+
+    const auto ref = [&] (int k) {
+        return QString("%1[%2]").arg(IsTrace(net.nodes[k].type) ? "t" : "s").arg(net.nodes[k].index);
+    };
+
+    const auto join = [&] (int k, QString op, QString empty) {
+        const SimNetwork::Slot &node = net.nodes[k];
+        QStringList terms;
+        for (int i = node.first; i < node.first + node.count; ++ i)
+            terms.append(ref(net.from[i]));
+        return terms.empty() ? empty : terms.join(op);
+    };
+
+    const auto any = [&] (int k) { return "(" + join(k, " | ", "0") + ")"; };
+    const auto all = [&] (int k) { return "(" + join(k, " & ", "0") + ")"; };
+    const auto odd = [&] (int k) { return "(" + join(k, " ^ ", "0") + ")"; };
+
+    QStringList &src = results.source;
+
+    src.append(QString("// generated by vcbtool %1 from a %2x%3 blueprint").arg(VCBTOOL_VERSION).arg(bpwidth_).arg(bpheight_));
+    src.append(QString("// %1 traces, %2 gates, %3 ports. clock period %4, timer period %5.")
+               .arg(net.traces.size()).arg(net.gates.size()).arg(ports.size()).arg(settings.clockPeriod).arg(settings.timerPeriod));
+    src.append("//");
+    src.append("// standalone benchmark:  c++ -O2 -DVCB_STANDALONE -o sim sim.cpp && ./sim [ticks]");
+    src.append("// loadable module:       c++ -O2 -shared -fPIC -o sim.so sim.cpp");
+    src.append("//");
+    src.append("// every value is 64 independent lanes (one circuit per bit). ports are the");
+    src.append("// detected inputs and outputs, see vcb_port_info().");
+    src.append("");
+    src.append("#include <cstdint>");
+    src.append("#include <cstring>");
+    src.append("");
+    src.append("#if defined(_WIN32)");
+    src.append("#  define VCB_API extern \"C\" __declspec(dllexport)");
+    src.append("#else");
+    src.append("#  define VCB_API extern \"C\" __attribute__((visibility(\"default\")))");
+    src.append("#endif");
+    src.append("");
+    src.append("typedef uint64_t vcb_word;");
+    src.append("static const vcb_word ON = ~(vcb_word)0;");
+    src.append("");
+    src.append(QString("static vcb_word t[%1];   // traces").arg(std::max(1, (int)net.traces.size())));
+    src.append(QString("static vcb_word s[%1];   // gate states").arg(std::max(1, (int)net.gates.size())));
+    src.append(QString("static vcb_word n[%1];   // next gate states").arg(std::max(1, (int)net.gates.size())));
+    src.append(QString("static vcb_word x[%1];   // external inputs").arg(std::max(1, net.exts)));
+    src.append(QString("static vcb_word l[%1];   // previous latch inputs").arg(std::max(1, net.latches)));
+    src.append("static uint64_t tick;");
+    src.append("static uint64_t rng;");
+    src.append("static bool dirty;");
+    src.append("");
+    src.append("struct vcb_port { int x, y, output, trace, slot, ext; };");
+    src.append("static const vcb_port ports[] = {");
+    for (const Node *node : ports) {
+        const SimNetwork::Slot &port = net.nodes[net.slots[node->id]];
+        src.append(QString("    { %1, %2, %3, %4, %5, %6 },")
+                   .arg(node->id % bpwidth_).arg(node->id / bpwidth_)
+                   .arg(node->purpose == Node::Output ? 1 : 0)
+                   .arg(IsTrace(port.type) ? 1 : 0)
+                   .arg(port.index)
+                   .arg(port.ext));
+    }
+    src.append("    { -1, -1, 0, 0, 0, -1 }");
+    src.append("};");
+    src.append(QString("static const int nports = %1;").arg(ports.size()));
+    src.append("");
+    src.append("static inline vcb_word random_word () {");
+    src.append("    rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;");
+    src.append("    return rng;");
+    src.append("}");
+    src.append("");
+    src.append("static void settle () {");
+    src.append("    if (!dirty) return;");
+    for (int k : net.traces) {
+        const SimNetwork::Slot &node = net.nodes[k];
+        QString value = (node.ext >= 0 ? QString("x[%1]").arg(node.ext) : any(k));
+        src.append(QString("    %1 = %2;").arg(ref(k), value));
+    }
+    src.append("    dirty = false;");
+    src.append("}");
+    src.append("");
+    src.append("static void step () {");
+    src.append("    settle();");
+    for (int k : net.gates) {
+        const SimNetwork::Slot &node = net.nodes[k];
+        QString next = QString("n[%1]").arg(node.index);
+        QString value;
+        switch (node.op) {
+        case OpAny: value = any(k); break;
+        case OpNotAny: value = "~" + any(k); break;
+        case OpAll: value = all(k); break;
+        case OpNotAll: value = "~" + all(k); break;
+        case OpOdd: value = odd(k); break;
+        case OpNotOdd: value = "~" + odd(k); break;
+        case OpClock: value = QString("(tick % %1 == 0 ? ON : 0)").arg(std::max(1, settings.clockPeriod)); break;
+        case OpTimer: value = QString("(tick % %1 == 0 ? ON : 0)").arg(std::max(1, settings.timerPeriod)); break;
+        case OpRandom: value = "random_word()"; break;
+        case OpLatch: {
+            QString prev = QString("l[%1]").arg(node.latch);
+            src.append(QString("    { vcb_word v = %1; %2 = %3 ^ (v & ~%4); %4 = v; }")
+                       .arg(any(k), next, ref(k), prev));
+            continue;
+        }
+        }
+        src.append(QString("    %1 = %2;").arg(next, value));
+    }
+    src.append("    memcpy(s, n, sizeof(s));");
+    src.append("    ++ tick;");
+    src.append("    dirty = true;");
+    src.append("}");
+    src.append("");
+    src.append("VCB_API void vcb_reset () {");
+    src.append("    memset(t, 0, sizeof(t));");
+    src.append("    memset(s, 0, sizeof(s));");
+    src.append("    memset(x, 0, sizeof(x));");
+    src.append("    memset(l, 0, sizeof(l));");
+    for (int k : net.gates)
+        if (net.nodes[k].type == LatchOn)
+            src.append(QString("    %1 = ON;").arg(ref(k)));
+    src.append("    tick = 0;");
+    src.append("    rng = 0x9E3779B97F4A7C15ULL;");
+    src.append("    dirty = true;");
+    src.append("}");
+    src.append("");
+    src.append("VCB_API void vcb_step (uint64_t ticks) {");
+    src.append("    while (ticks --) step();");
+    src.append("}");
+    src.append("");
+    src.append("VCB_API uint64_t vcb_ticks () {");
+    src.append("    return tick;");
+    src.append("}");
+    src.append("");
+    src.append("VCB_API int vcb_port_count () {");
+    src.append("    return nports;");
+    src.append("}");
+    src.append("");
+    src.append("VCB_API int vcb_port_info (int port, int *px, int *py, int *output) {");
+    src.append("    if (port < 0 || port >= nports) return 0;");
+    src.append("    if (px) *px = ports[port].x;");
+    src.append("    if (py) *py = ports[port].y;");
+    src.append("    if (output) *output = ports[port].output;");
+    src.append("    return 1;");
+    src.append("}");
+    src.append("");
+    src.append("// input traces are driven externally; setting any other port overrides its state");
+    src.append("VCB_API void vcb_set (int port, vcb_word lanes) {");
+    src.append("    if (port < 0 || port >= nports) return;");
+    src.append("    const vcb_port &p = ports[port];");
+    src.append("    if (p.ext >= 0) x[p.ext] = lanes;");
+    src.append("    else if (p.trace) t[p.slot] = lanes;");
+    src.append("    else s[p.slot] = lanes;");
+    src.append("    dirty = dirty || !p.trace || p.ext >= 0;");
+    src.append("}");
+    src.append("");
+    src.append("VCB_API vcb_word vcb_get (int port) {");
+    src.append("    if (port < 0 || port >= nports) return 0;");
+    src.append("    settle();");
+    src.append("    const vcb_port &p = ports[port];");
+    src.append("    return p.trace ? t[p.slot] : s[p.slot];");
+    src.append("}");
+    src.append("");
+    src.append("#ifdef VCB_STANDALONE");
+    src.append("#include <chrono>");
+    src.append("#include <cstdio>");
+    src.append("#include <cstdlib>");
+    src.append("");
+    src.append("int main (int argc, char **argv) {");
+    src.append("    uint64_t ticks = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000);");
+    src.append("    vcb_reset();");
+    src.append("    for (int p = 0; p < nports; ++ p)");
+    src.append("        if (!ports[p].output) vcb_set(p, random_word());");
+    src.append("    auto start = std::chrono::steady_clock::now();");
+    src.append("    vcb_step(ticks);");
+    src.append("    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;");
+    src.append("    double rate = (double)ticks / elapsed.count();");
+    src.append(QString("    printf(\"%d traces, %d gates\\n\", %1, %2);").arg(net.traces.size()).arg(net.gates.size()));
+    src.append("    printf(\"%llu ticks in %.3f s: %.0f ticks/s (%.0f lane-ticks/s)\\n\",");
+    src.append("           (unsigned long long)ticks, elapsed.count(), rate, rate * 64.0);");
+    src.append("    for (int p = 0; p < nports; ++ p)");
+    src.append("        if (ports[p].output)");
+    src.append("            printf(\"out %d,%d = %016llx\\n\", ports[p].x, ports[p].y, (unsigned long long)vcb_get(p));");
+    src.append("    return 0;");
+    src.append("}");
+    src.append("#endif");
+
+    results.traces = net.traces.size();
+    results.gates = net.gates.size();
+    results.ports = ports.size();
+
+    deleteComplexGraph(cgraph);
+
+    return results;
+
+}
+
+
+Compiler::Evaluator::Evaluator (const Compiler *compiler, SimSettings settings) :
+    compiler_(compiler),
+    settings_(settings),
+    net_(buildSimNetwork(compiler->sgraph_))
+{
+
+    values_.resize(net_.nodes.size());
+    next_.resize(net_.nodes.size());
+    ext_.resize(net_.exts);
+    latchIn_.resize(net_.latches);
+    reset();
+
+}
+
+
+void Compiler::Evaluator::reset () {
+
+    std::fill(values_.begin(), values_.end(), 0);
+    std::fill(ext_.begin(), ext_.end(), 0);
+    std::fill(latchIn_.begin(), latchIn_.end(), 0);
+    for (int k : net_.gates)
+        if (net_.nodes[k].type == LatchOn)
+            values_[k] = ~0ULL;
+    tick_ = 0;
+    rng_ = 0x9E3779B97F4A7C15ULL;
+    dirty_ = true;
+
+}
+
+
+int Compiler::Evaluator::slotAt (int x, int y) const {
+
+    if (x < 0 || y < 0 || x >= compiler_->bpwidth_ || y >= compiler_->bpheight_)
+        throw std::runtime_error(QString("Evaluator: (%1,%2) is outside the blueprint.").arg(x).arg(y).toStdString());
+    int slot = net_.slots.value(compiler_->entityAt(x, y), -1);
+    if (slot < 0)
+        throw std::runtime_error(QString("Evaluator: nothing at (%1,%2).").arg(x).arg(y).toStdString());
+    return slot;
+
+}
+
+
+void Compiler::Evaluator::set (int x, int y, quint64 lanes) {
+
+    const SimNetwork::Slot &node = net_.nodes[slotAt(x, y)];
+    if (node.ext < 0)
+        throw std::runtime_error(QString("Evaluator: (%1,%2) is not an input trace.").arg(x).arg(y).toStdString());
+    ext_[node.ext] = lanes;
+    dirty_ = true;
+
+}
+
+
+quint64 Compiler::Evaluator::get (int x, int y) {
+
+    int slot = slotAt(x, y);
+    settle();
+    return values_[slot];
+
+}
+
+
+// traces only ever read gates, so a single pass settles all of them.
+void Compiler::Evaluator::settle () {
+
+    if (!dirty_)
+        return;
+
+    for (int k : net_.traces) {
+        const SimNetwork::Slot &node = net_.nodes[k];
+        quint64 value = 0;
+        if (node.ext >= 0)
+            value = ext_[node.ext];
+        else
+            for (int i = node.first; i < node.first + node.count; ++ i)
+                value |= values_[net_.from[i]];
+        values_[k] = value;
+    }
+
+    dirty_ = false;
+
+}
+
+
+void Compiler::Evaluator::step (int ticks) {
+
+    while (ticks -- > 0) {
+
+        settle();
+
+        for (int k : net_.gates) {
+            const SimNetwork::Slot &node = net_.nodes[k];
+            const int *in = net_.from.constData() + node.first;
+            quint64 any = 0, all = (node.count ? ~0ULL : 0), odd = 0;
+            for (int i = 0; i < node.count; ++ i) {
+                any |= values_[in[i]];
+                all &= values_[in[i]];
+                odd ^= values_[in[i]];
+            }
+            quint64 value = 0;
+            switch (node.op) {
+            case OpAny: value = any; break;
+            case OpNotAny: value = ~any; break;
+            case OpAll: value = all; break;
+            case OpNotAll: value = ~all; break;
+            case OpOdd: value = odd; break;
+            case OpNotOdd: value = ~odd; break;
+            case OpClock: value = (tick_ % std::max(1, settings_.clockPeriod) == 0 ? ~0ULL : 0); break;
+            case OpTimer: value = (tick_ % std::max(1, settings_.timerPeriod) == 0 ? ~0ULL : 0); break;
+            case OpRandom:
+                rng_ ^= rng_ << 13; rng_ ^= rng_ >> 7; rng_ ^= rng_ << 17;
+                value = rng_;
+                break;
+            case OpLatch:
+                value = values_[k] ^ (any & ~latchIn_[node.latch]);
+                latchIn_[node.latch] = any;
+                break;
+            }
+            next_[k] = value;
+        }
+
+        for (int k : net_.gates)
+            values_[k] = next_[k];
+        ++ tick_;
+        dirty_ = true;
+
+    }
+
+}
+
+
 Compiler::SimpleGraph Compiler::compressedConnections () const {
 
     ComplexGraph nodes = buildComplexGraph(sgraph_);
@@ -617,12 +1085,41 @@ Compiler::SimpleGraph Compiler::compressedConnections () const {
 }
 
 
+Compiler::Netlist Compiler::netlist () const {
+
+    const SimpleGraph graph = compressedConnections();
+
+    Netlist netlist;
+    netlist.width = bpwidth_;
+    netlist.height = bpheight_;
+    netlist.entities = graph.entities;
+    netlist.connections = graph.connections;
+    netlist.pixels.resize(bpwidth_ * bpheight_);
+    for (int y = 0; y < bpheight_; ++ y)
+        for (int x = 0; x < bpwidth_; ++ x)
+            netlist.pixels[y * bpwidth_ + x] = entityAt(x, y);
+    return netlist;
+
+}
+
+
+int Compiler::entityAt (int x, int y) const {
+
+    const int TileSize = Blueprint::TileSize;
+    const int slot = tileSlots_[(y / TileSize) * ((bpwidth_ + TileSize - 1) / TileSize) + x / TileSize];
+    if (slot < 0)
+        return y * bpwidth_ + x;
+    return pixels_[slot * TileSize * TileSize + (y % TileSize) * TileSize + x % TileSize];
+
+}
+
+
 QStringList Compiler::analyzeCircuit (const AnalysisSettings &settings) const {
 
     ComplexGraph nodes = buildComplexGraph(sgraph_);
 
-    if (settings.checkLoops)
-        computeTimings(nodes); // will set isloop flags
+    if (settings.checkLoops || settings.checkGlitches)
+        computeTimings(nodes, settings.timing); // will set isloop flags and min/max timings
 
     QStringList results;
 
@@ -645,6 +1142,87 @@ QStringList Compiler::analyzeCircuit (const AnalysisSettings &settings) const {
     const int GateMinIn = settings.checkGates ? 2 : 1;
     const bool CheckTraces = settings.checkTraces;
 
+    // source signatures, one linear pass in topological order: each timed node gets the
+    // bits of the sources (timing roots) upstream of it, one hashed bit per source. inputs
+    // whose signatures don't overlap can't share an ancestor, which settles most nodes
+    // without walking anything.
+    struct Signature {
+        quint64 bits[4];
+        bool isEmpty () const { return !(bits[0] | bits[1] | bits[2] | bits[3]); }
+        bool overlaps (const Signature &other) const {
+            return (bits[0] & other.bits[0]) || (bits[1] & other.bits[1]) || (bits[2] & other.bits[2]) || (bits[3] & other.bits[3]);
+        }
+        void add (const Signature &other) {
+            for (int k = 0; k < 4; ++ k)
+                bits[k] |= other.bits[k];
+        }
+    };
+    QVector<Signature> signatures;
+    if (settings.checkGlitches) {
+        QVector<Node *> order(nodes.size());
+        for (Node *node : nodes.values())
+            order[node->order] = node;
+        signatures.fill(Signature{ { 0, 0, 0, 0 } }, nodes.size());
+        for (const Node *node : order) {
+            if (node->maxtiming < 0)
+                continue;
+            Signature &signature = signatures[node->order];
+            if (!node->source())
+                for (const Node *from : node->from)
+                    if (from->maxtiming >= 0 && from->feeds(node))
+                        signature.add(signatures[from->order]);
+            if (node->source() || signature.isEmpty()) {
+                const quint32 bit = ((quint32)node->id * 2654435761u) >> 24;
+                signature.bits[bit >> 6] |= 1ULL << (bit & 63);
+            }
+        }
+    }
+
+    // which inputs share an ancestor with an input that arrives in a different window.
+    // walks back from every window at once (windows as bits, so at most 64); a node
+    // reached from two windows is a common ancestor. the walk is capped, and if a huge
+    // fan-in cone (or more than 64 windows) means it couldn't look at everything,
+    // complete is set to false so that's reported rather than passed as clean.
+    const auto reconvergentInputs = [] (const QVector<const Node *> &inputs, const QVector<QPair<int,int> > &windows, bool *complete) {
+        constexpr int MaxVisits = 4096;
+        QVector<QPair<int,int> > distinct;
+        QVector<int> group(inputs.size());
+        for (int k = 0; k < inputs.size(); ++ k) {
+            group[k] = distinct.indexOf(windows[k]);
+            if (group[k] < 0) {
+                group[k] = distinct.size();
+                distinct.append(windows[k]);
+            }
+        }
+        QHash<const Node *,quint64> reached; // node => windows that reach it
+        QVector<QPair<const Node *,int> > work;
+        for (int k = 0; k < inputs.size(); ++ k)
+            if (group[k] < 64)
+                work.append({ inputs[k], group[k] });
+        quint64 shared = 0;
+        int visits = 0;
+        while (!work.isEmpty() && visits++ < MaxVisits) {
+            const QPair<const Node *,int> item = work.takeLast();
+            const quint64 bit = 1ULL << item.second;
+            quint64 &mask = reached[item.first];
+            if (mask & bit)
+                continue;
+            if (mask)
+                shared |= mask | bit;
+            mask |= bit;
+            if (item.first->source())
+                continue;
+            for (const Node *from : item.first->from)
+                if (from->maxtiming >= 0 && from->feeds(item.first))
+                    work.append({ from, item.second });
+        }
+        *complete = work.isEmpty() && distinct.size() <= 64;
+        QVector<bool> involved(inputs.size());
+        for (int k = 0; k < inputs.size(); ++ k)
+            involved[k] = (group[k] < 64 && (shared & (1ULL << group[k])));
+        return involved;
+    };
+
     for (Node *node : nodes.values()) {
         // unused traces
         if (CheckTraces) {
@@ -677,6 +1255,57 @@ QStringList Compiler::analyzeCircuit (const AnalysisSettings &settings) const {
         if (settings.checkLoops && node->isloop) {
             print(node, "circuit loop");
         }
+        // glitches: inputs that share an ancestor but arrive in different windows, so one
+        // change upstream reaches the node on different ticks. inputs from independent
+        // sources are fine, and a skew is only reported where the paths reconverge.
+        if (settings.checkGlitches) {
+            QVector<const Node *> inputs;
+            QVector<QPair<int,int> > windows; // (min, max) arrival of each input
+            for (const Node *from : node->from) {
+                if (from->maxtiming < 0 || !from->feeds(node))
+                    continue;
+                inputs.append(from);
+                windows.append({ from->mintiming + from->delay(), from->maxtiming + from->delay() });
+            }
+            // only walk back if inputs in different windows could have a source in common
+            QVector<QPair<int,int> > distinct;
+            QVector<Signature> upstream; // of each distinct window
+            for (int k = 0; k < inputs.size(); ++ k) {
+                int index = distinct.indexOf(windows[k]);
+                if (index < 0) {
+                    index = distinct.size();
+                    distinct.append(windows[k]);
+                    upstream.append(Signature{ { 0, 0, 0, 0 } });
+                }
+                upstream[index].add(signatures[inputs[k]->order]);
+            }
+            bool suspect = false;
+            for (int i = 0; i < upstream.size() && !suspect; ++ i)
+                for (int j = i + 1; j < upstream.size() && !suspect; ++ j)
+                    suspect = upstream[i].overlaps(upstream[j]);
+            bool complete = true;
+            const QVector<bool> involved = suspect ? reconvergentInputs(inputs, windows, &complete) : QVector<bool>();
+            if (!complete)
+                print(node, QString("glitch check incomplete, %1 has too big a fan-in cone to check every path").arg(Desc(node->type)));
+            int earliest = -1, latest = -1;
+            for (int k = 0; k < involved.size(); ++ k) {
+                if (!involved[k])
+                    continue;
+                earliest = (earliest >= 0 ? std::min(earliest, windows[k].first) : windows[k].first);
+                latest = std::max(latest, windows[k].second);
+            }
+            if (earliest >= 0) {
+                QStringList delays;
+                for (int k = 0; k < involved.size(); ++ k)
+                    if (involved[k] && windows[k].second < latest)
+                        delays.append(QString("%1,%2 by %3").arg(inputs[k]->id % bpwidth_).arg(inputs[k]->id / bpwidth_).arg(latest - windows[k].second));
+                QString message = QString("possible glitch, %1 inputs from a common source arrive at ticks %2-%3 (skew %4)")
+                        .arg(Desc(node->type)).arg(earliest).arg(latest).arg(latest - earliest);
+                if (!delays.isEmpty())
+                    message += QString("; to equalise, buffer %1").arg(delays.join(", "));
+                print(node, message);
+            }
+        }
     }
 
     deleteComplexGraph(nodes);
@@ -740,6 +1369,285 @@ QStringList Compiler::analyzeBlueprint (const AnalysisSettings &settings, const
 }
 
 
+// required times and slack come from one backward pass over the topological order. the
+// worst paths are found with a best-first search backwards from the outputs: a partial
+// path's bound is the arrival time at its first node plus the delay already collected,
+// which is exact, so complete paths come off the queue worst first and only the paths
+// that are actually reported ever get expanded.
+Compiler::TimingReport Compiler::buildTimingReport (const TimingSettings &settings, int worstPaths) const {
+
+    TimingReport report;
+
+    ComplexGraph graph = buildComplexGraph(sgraph_);
+    report.stats = computeTimings(graph, settings);
+
+    const int deadline = report.stats.maxmaxtime;
+    if (deadline < 0) {
+        deleteComplexGraph(graph);
+        return report;
+    }
+
+    QVector<Node *> order(graph.size());
+    for (Node *node : graph.values())
+        order[node->order] = node;
+
+    // --- required times
+
+    QHash<const Node *,int> required;
+    for (int k = order.size() - 1; k >= 0; -- k) {
+        const Node *node = order[k];
+        if (node->maxtiming < 0)
+            continue;
+        int req = deadline;
+        for (const Node *to : node->to) {
+            if (to->skip && IsLatch(to->type)) // register input, an endpoint like an output
+                req = std::min(req, deadline - node->delay());
+            else if (node->feeds(to) && to->maxtiming >= 0)
+                req = std::min(req, required[to] - node->delay());
+        }
+        required[node] = req;
+    }
+
+    for (const Node *node : order) {
+        if (node->maxtiming < 0)
+            continue;
+        NodeTiming t;
+        t.x = node->id % bpwidth_;
+        t.y = node->id / bpwidth_;
+        t.type = node->type;
+        t.mintime = node->mintiming;
+        t.maxtime = node->maxtiming;
+        t.required = required[node];
+        t.slack = t.required - t.maxtime;
+        report.nodes.append(t);
+    }
+
+    for (const Node *node : order) {
+        if (!report.stats.endpoints.contains(node->id))
+            continue;
+        NodeTiming t;
+        t.x = node->id % bpwidth_;
+        t.y = node->id / bpwidth_;
+        t.type = node->type;
+        t.mintime = report.stats.endpoints[node->id].first;
+        t.maxtime = report.stats.endpoints[node->id].second;
+        t.required = deadline;
+        t.slack = t.required - t.maxtime;
+        report.outputs.append(t);
+    }
+
+    // --- worst paths
+
+    struct Partial {
+        const Node *node;
+        int delay;  // collected from node (inclusive) to the output (exclusive)
+        int next;   // index of the next partial towards the output, or -1
+    };
+
+    constexpr int MaxPartials = 4000000; // don't let pathological fan-in eat all memory
+
+    QVector<Partial> partials;
+    std::priority_queue<QPair<int,int> > queue; // (bound, partial index)
+
+    for (const Node *node : order) {
+        if (report.stats.endpoints.contains(node->id)) {
+            queue.push({report.stats.endpoints[node->id].second, (int)partials.size()});
+            partials.append({node, 0, -1});
+        }
+    }
+
+    while (!queue.empty() && report.paths.size() < worstPaths && partials.size() < MaxPartials) {
+        const int bound = queue.top().first;
+        const int index = queue.top().second;
+        queue.pop();
+        const Partial p = partials[index];
+        bool source = true;
+        const bool endpoint = (p.next == -1 && p.node->skip); // register input
+        for (const Node *from : p.node->from) {
+            if (from->maxtiming < 0 || !(endpoint || from->feeds(p.node)))
+                continue;
+            source = false;
+            int delay = p.delay + from->delay();
+            queue.push({from->maxtiming + delay, (int)partials.size()});
+            partials.append({from, delay, index});
+        }
+        if (source) {
+            TimingPath path;
+            path.length = bound;
+            for (int k = index; k >= 0; k = partials[k].next)
+                path.points.append(QPoint(partials[k].node->id % bpwidth_, partials[k].node->id / bpwidth_));
+            report.paths.append(path);
+        }
+    }
+
+    deleteComplexGraph(graph);
+
+    return report;
+
+}
+
+
+QString Compiler::TimingReport::toCSV () const {
+
+    QStringList lines;
+
+    lines.append("x,y,type,min,max,required,slack");
+    for (const NodeTiming &t : nodes)
+        lines.append(QString("%1,%2,%3,%4,%5,%6,%7").arg(t.x).arg(t.y).arg(Desc(t.type))
+                     .arg(t.mintime).arg(t.maxtime).arg(t.required).arg(t.slack));
+
+    lines.append("");
+    lines.append("x,y,type,min,max (outputs)");
+    for (const NodeTiming &t : outputs)
+        lines.append(QString("%1,%2,%3,%4,%5").arg(t.x).arg(t.y).arg(Desc(t.type)).arg(t.mintime).arg(t.maxtime));
+
+    lines.append("");
+    lines.append("rank,length,path");
+    for (int k = 0; k < paths.size(); ++ k) {
+        QStringList points;
+        for (const QPoint &p : paths[k].points)
+            points.append(QString("%1 %2").arg(p.x()).arg(p.y()));
+        lines.append(QString("%1,%2,\"%3\"").arg(k + 1).arg(paths[k].length).arg(points.join(";")));
+    }
+
+    return lines.join("\n") + "\n";
+
+}
+
+
+QByteArray Compiler::TimingReport::toJSON () const {
+
+    QJsonObject jstats;
+    jstats["minmaxtime"] = stats.minmaxtime;
+    jstats["maxmintime"] = stats.maxmintime;
+    jstats["maxmaxtime"] = stats.maxmaxtime;
+    jstats["critpathlen"] = stats.critpathlen;
+
+    QJsonArray jnodes;
+    for (const NodeTiming &t : nodes) {
+        QJsonObject jnode;
+        jnode["x"] = t.x;
+        jnode["y"] = t.y;
+        jnode["type"] = Desc(t.type);
+        jnode["min"] = t.mintime;
+        jnode["max"] = t.maxtime;
+        jnode["required"] = t.required;
+        jnode["slack"] = t.slack;
+        jnodes.append(jnode);
+    }
+
+    QJsonArray joutputs;
+    for (const NodeTiming &t : outputs) {
+        QJsonObject joutput;
+        joutput["x"] = t.x;
+        joutput["y"] = t.y;
+        joutput["type"] = Desc(t.type);
+        joutput["min"] = t.mintime;
+        joutput["max"] = t.maxtime;
+        joutputs.append(joutput);
+    }
+
+    QJsonArray jpaths;
+    for (const TimingPath &path : paths) {
+        QJsonArray jpoints;
+        for (const QPoint &p : path.points)
+            jpoints.append(QJsonArray({ p.x(), p.y() }));
+        QJsonObject jpath;
+        jpath["length"] = path.length;
+        jpath["points"] = jpoints;
+        jpaths.append(jpath);
+    }
+
+    QJsonObject jreport;
+    jreport["stats"] = jstats;
+    jreport["nodes"] = jnodes;
+    jreport["outputs"] = joutputs;
+    jreport["paths"] = jpaths;
+
+    return QJsonDocument(jreport).toJson();
+
+}
+
+
+// one pass in topological order carrying, for every node, the latest arrival from any
+// register and which register it came from. each destination register then knows its
+// worst source without looking at register pairs individually.
+Compiler::RegisterReport Compiler::buildRegisterReport (int worstPairs) const {
+
+    RegisterReport report;
+
+    ComplexGraph graph = buildComplexGraph(sgraph_);
+
+    TimingSettings settings;
+    settings.skipLatches = true;
+    computeTimings(graph, settings);
+
+    QVector<Node *> order(graph.size());
+    for (Node *node : graph.values())
+        order[node->order] = node;
+
+    QHash<const Node *,QPair<int,const Node *> > arrival; // (ticks, source register)
+    for (const Node *node : order) {
+        if (node->isloop)
+            ++ report.loops;
+        if (IsLatch(node->type)) {
+            ++ report.registers;
+            arrival[node] = { 0, node };
+        }
+        if (!arrival.contains(node))
+            continue;
+        const QPair<int,const Node *> here = arrival[node];
+        for (const Node *to : node->to) {
+            if (!node->feeds(to))
+                continue;
+            int ticks = here.first + node->delay();
+            if (!arrival.contains(to) || ticks > arrival[to].first)
+                arrival[to] = { ticks, here.second };
+        }
+    }
+
+    const auto point = [&] (const Node *node) {
+        return QPoint(node->id % bpwidth_, node->id / bpwidth_);
+    };
+
+    for (const Node *node : order) {
+        if (!IsLatch(node->type))
+            continue;
+        RegisterPath path;
+        path.length = -1;
+        for (const Node *from : node->from) {
+            if (!arrival.contains(from))
+                continue;
+            int ticks = arrival[from].first + from->delay();
+            if (ticks > path.length) {
+                path.length = ticks;
+                path.from = point(arrival[from].second);
+            }
+        }
+        if (path.length >= 0) {
+            path.to = point(node);
+            report.paths.append(path);
+        }
+    }
+
+    std::stable_sort(report.paths.begin(), report.paths.end(), [] (const RegisterPath &a, const RegisterPath &b) {
+        return a.length > b.length;
+    });
+    if (report.paths.size() > worstPairs)
+        report.paths.resize(worstPairs);
+
+    if (!report.paths.empty()) {
+        report.worstPath = report.paths.first().length;
+        report.minCycleTicks = report.worstPath + 1;
+    }
+
+    deleteComplexGraph(graph);
+
+    return report;
+
+}
+
+
 Compiler::ComplexGraph Compiler::buildComplexGraph (const SimpleGraph &sgraph) {
 
     ComplexGraph nodes;
@@ -773,38 +1681,79 @@ Compiler::ComplexGraph Compiler::buildComplexGraph (const SimpleGraph &sgraph) {
 }
 
 
-Compiler::TimingStats Compiler::computeTimings (ComplexGraph &graph) {
-
-    TimingStats stats;
+// depth-first walk (sources first) that returns the nodes in topological order and sets
+// Node::order accordingly. a connection that would close a loop is left pointing
+// backwards in the order (see Node::feeds) and its target gets flagged with isloop.
+// iterative rather than recursive since large circuits have very deep paths.
+QVector<Compiler::Node *> Compiler::topologicalOrder (ComplexGraph &graph) {
 
-    const std::function<void(Node*,int,int)> compute = [&compute] (Node *node, int tickmin, int tickmax) {
-        if (node->hit) {
-            node->isloop = true;
-            //qDebug() << "node" << node->id << Desc(node->type) << "is loop; breaking...";
-            return;
-        }
-        // early walk abort
-        if (node->mintiming >= 0 && tickmin >= node->mintiming && tickmax <= node->maxtiming) {
-            // then this particular path isn't going to affect any future min/max, so we can just abort.
-            return;
-        }
-        // end early walk abort
-        node->mintiming = (node->mintiming >= 0 ? std::min(node->mintiming, tickmin) : tickmin);
-        node->maxtiming = std::max(node->maxtiming, tickmax);
-        int nexttickmin = IsTrace(node->type) ? node->mintiming : (node->mintiming + 1);
-        int nexttickmax = IsTrace(node->type) ? node->maxtiming : (node->maxtiming + 1);
-        for (Node *to : node->to) {
-            node->hit = true;
-            compute(to, nexttickmin, nexttickmax);
-            node->hit = false;
+    QVector<Node *> roots, postorder;
+    for (Node *node : graph.values()) {
+        node->order = -1;
+        node->hit = false;
+        node->isloop = false;
+        if (node->source())
+            roots.append(node);
+    }
+    for (Node *node : graph.values())
+        if (!node->source())
+            roots.append(node);
+
+    QVector<QPair<Node *,int> > stack;
+    for (Node *root : roots) {
+        if (root->order >= 0 || root->hit)
+            continue;
+        root->hit = true;
+        stack.append({root, 0});
+        while (!stack.empty()) {
+            Node *node = stack.last().first;
+            int next = stack.last().second;
+            if (next < node->to.size()) {
+                Node *to = node->to[next];
+                stack.last().second = next + 1;
+                if (to->skip) {
+                    // skipped sources cut the graph, nothing flows into them
+                } else if (to->hit) {
+                    to->isloop = true;
+                } else if (to->order < 0) {
+                    to->hit = true;
+                    stack.append({to, 0});
+                }
+            } else {
+                node->hit = false;
+                node->order = postorder.size(); // finished marker, renumbered below
+                postorder.append(node);
+                stack.removeLast();
+            }
         }
-    };
+    }
+
+    QVector<Node *> order(postorder.size());
+    for (int k = 0; k < postorder.size(); ++ k) {
+        Node *node = postorder[postorder.size() - 1 - k];
+        node->order = k;
+        order[k] = node;
+    }
+
+    return order;
+
+}
+
+
+Compiler::TimingStats Compiler::computeTimings (ComplexGraph &graph, const TimingSettings &settings) {
+
+    TimingStats stats;
 
     for (Node *node : graph.values()) {
+        const bool sourcetype = (node->type == Clock || node->type == Timer || node->type == Random);
+        node->skip = (settings.skipLatches && IsLatch(node->type)) || (settings.skipSources && sourcetype);
+    }
+
+    QVector<Node *> order = topologicalOrder(graph); // also sets isloop flags
+
+    for (Node *node : order) {
         node->mintiming = node->maxtiming = -1;
         node->critpath = false;
-        node->hit = false;
-        node->isloop = false;
     }
 
     // debug
@@ -822,20 +1771,42 @@ Compiler::TimingStats Compiler::computeTimings (ComplexGraph &graph) {
     }
     // end debug
 
-    int progress = 0;
-    for (Node *node : graph.values())
-        if (node->purpose == Node::Input) {
-            qDebug() << (++progress);
-            compute(node, 0, 0);
+    // single pass in topological order; connections that close loops are skipped, so
+    // timing through a loop is still abandoned, just without exploring every path.
+    for (Node *node : order) {
+        if (node->source())
+            node->mintiming = node->maxtiming = 0;
+        if (node->mintiming < 0)
+            continue;
+        int nexttickmin = node->mintiming + node->delay();
+        int nexttickmax = node->maxtiming + node->delay();
+        for (Node *to : node->to) {
+            if (!node->feeds(to))
+                continue;
+            to->mintiming = (to->mintiming >= 0 ? std::min(to->mintiming, nexttickmin) : nexttickmin);
+            to->maxtiming = std::max(to->maxtiming, nexttickmax);
         }
+    }
 
-    int maxmintime = -1, maxmaxtime = -1, minmaxtime = -1;
-    for (Node *node : graph.values()) {
-        if (node->purpose == Node::Output) {
-            maxmintime = std::max(maxmintime, node->mintiming);
-            minmaxtime = (minmaxtime == -1 ? node->maxtiming : std::min(minmaxtime, node->maxtiming));
-            maxmaxtime = std::max(maxmaxtime, node->maxtiming);
+    // endpoints are the outputs and, when latches are skipped, the latch inputs (i.e.
+    // register inputs, which get their arrival from whatever feeds them).
+    for (Node *node : order) {
+        int tmin = -1, tmax = -1;
+        if (node->skip && IsLatch(node->type))
+            node->inputWindow(&tmin, &tmax);
+        else if (node->purpose == Node::Output) {
+            tmin = node->mintiming;
+            tmax = node->maxtiming;
         }
+        if (tmax >= 0)
+            stats.endpoints[node->id] = { tmin, tmax };
+    }
+
+    int maxmintime = -1, maxmaxtime = -1, minmaxtime = -1;
+    for (const QPair<int,int> &arrival : stats.endpoints) {
+        maxmintime = std::max(maxmintime, arrival.first);
+        minmaxtime = (minmaxtime == -1 ? arrival.second : std::min(minmaxtime, arrival.second));
+        maxmaxtime = std::max(maxmaxtime, arrival.second);
     }
     qDebug() << "maxmintime" << maxmintime << "minmaxtime" << minmaxtime << "maxmaxtime" << maxmaxtime;
 
@@ -845,8 +1816,8 @@ Compiler::TimingStats Compiler::computeTimings (ComplexGraph &graph) {
 
     //bool critpathEndsWithEntity = false;
     QList<Node *> critnodes;
-    for (Node *node : graph.values())
-        if (node->purpose == Node::Output && node->maxtiming == maxmaxtime) {
+    for (Node *node : order)
+        if (stats.endpoints.contains(node->id) && stats.endpoints[node->id].second == maxmaxtime) {
             critnodes.append(node);
             qDebug() << "  crit node type" << Desc(node->type);
             //if (!IsTrace(node->type))
@@ -859,27 +1830,30 @@ Compiler::TimingStats Compiler::computeTimings (ComplexGraph &graph) {
     // actually, for now just leave it because current output node detection will force it
     // to be either a trace or an LED, and it's not really useful to count the LED.
     stats.critpathlen = maxmaxtime;
-    // in fact, we should probably also subtract 1 if the input nodes are latches because
-    // that usually just means the blueprint contained latches for test input. but that's
-    // a little more complicated and it would be better to make input latches just not
-    // count for a tick in the timing analysis.
-    // hmm the best approach is probably a checkbox that says "skip input latches" in tick
-    // counts.
-    // TODO
+    // input latches that are only there for test input used to add a tick here; that's
+    // what TimingSettings::skipLatches is for.
 
+    // walk back along whatever arrives exactly on time. skipped latches are endpoints
+    // on the first step only; after that they're sources and the walk stops there.
     QSet<Node *> visited;
+    bool first = true;
     while (!critnodes.empty()) {
         QSet<Node *> prev;
         for (Node *node : critnodes) {
             if (!visited.contains(node)) {
                 visited.insert(node);
                 node->critpath = true;
+                const bool endpoint = first && node->skip;
+                int arrival = node->maxtiming, tmin;
+                if (endpoint)
+                    node->inputWindow(&tmin, &arrival);
                 for (Node *from : node->from)
-                    if (from->maxtiming >= node->maxtiming - 1)
+                    if ((endpoint || from->feeds(node)) && from->maxtiming >= 0 && from->maxtiming + from->delay() == arrival)
                         prev.insert(from);
             }
         }
         critnodes = prev.values();
+        first = false;
     }
 
     return stats;
@@ -4,7 +4,9 @@
 #include "blueprint.h"
 #include <QObject>
 #include <QSet>
+#include <QHash>
 #include <QMap>
+#include <QPoint>
 
 class Compiler : public QObject {
     Q_OBJECT
@@ -108,9 +110,19 @@ public:
         int maxmintime;
         int maxmaxtime;
         int critpathlen;
+        QMap<int,QPair<int,int> > endpoints; // node id => (min, max) arrival at each output
         TimingStats () : minmaxtime(-1), maxmintime(-1), maxmaxtime(-1), critpathlen(-1) { }
     };
 
+    // skipped components count as zero-delay timing sources: they start at tick 0 no
+    // matter what feeds them. skipped latches also become endpoints, so timings measure
+    // the combinational depth between registers rather than including test input latches.
+    struct TimingSettings {
+        bool skipLatches;
+        bool skipSources; // clocks, timers, random
+        TimingSettings () : skipLatches(false), skipSources(false) { }
+    };
+
     struct GraphSettings {
         enum PosMode { None=0, Absolute=1, Suggested=2 };
         bool compressed;
@@ -122,6 +134,7 @@ public:
         bool squareio;
         bool highlightloops;
         bool iecsymbols;
+        TimingSettings timing;
         GraphSettings () : compressed(false), ioclusters(false), timings(false), timinglabels(false), positions(None), scale(1.0f), squareio(false), highlightloops(true), iecsymbols(false) { }
     };
 
@@ -132,18 +145,144 @@ public:
 
     GraphResults buildGraphViz (GraphSettings settings) const;
 
+    // clocks and timers are configured in-game and their periods aren't stored in the
+    // blueprint, so the simulator needs to be told what they are.
+    struct SimSettings {
+        int clockPeriod;
+        int timerPeriod;
+        SimSettings () : clockPeriod(2), timerPeriod(60) { }
+    };
+
+    struct SimResults {
+        QStringList source;
+        int traces;
+        int gates;
+        int ports;
+        SimResults () : traces(0), gates(0), ports(0) { }
+    };
+
+    SimResults buildSimulator (SimSettings settings) const;
+
+private:
+
+    // the one definition of what a node computes each tick, shared by Evaluator and the
+    // code buildSimulator() generates so the two can't drift apart.
+    enum SimOp { OpAny, OpNotAny, OpAll, OpNotAll, OpOdd, OpNotOdd, OpClock, OpTimer, OpRandom, OpLatch };
+    static SimOp SimOpFor (Component type);
+
+    // a graph laid out for simulation. traces only read gates, so settling them is a
+    // single pass over traces; gates then step from the settled values.
+    struct SimNetwork {
+        struct Slot {
+            Component type;
+            SimOp op;
+            int index;        // in traces or gates
+            int first, count; // inputs, in from
+            int ext;          // input traces: external input index, else -1
+            int latch;        // latches: previous input index, else -1
+        };
+        QVector<Slot> nodes;
+        QVector<int> from;
+        QVector<int> traces, gates; // indices in nodes
+        QHash<int,int> slots;       // entity id => index in nodes
+        int exts, latches;
+    };
+    struct SimpleGraph;
+    static SimNetwork buildSimNetwork (const SimpleGraph &graph);
+
+public:
+
+    // runs the circuit in-process with the same semantics as buildSimulator(), 64
+    // independent lanes at a time. nodes are addressed by any of their pixels. meant for
+    // checking generated circuits; the compiler has to outlive it.
+    class Evaluator {
+    public:
+        explicit Evaluator (const Compiler *compiler, SimSettings settings = SimSettings());
+        void reset ();
+        void set (int x, int y, quint64 lanes); // input traces only
+        quint64 get (int x, int y);
+        void step (int ticks = 1);
+        quint64 ticks () const { return tick_; }
+    private:
+        const Compiler *compiler_;
+        SimSettings settings_;
+        SimNetwork net_;
+        QVector<quint64> values_, next_, ext_, latchIn_;
+        quint64 tick_;
+        quint64 rng_;
+        bool dirty_;
+        int slotAt (int x, int y) const;
+        void settle ();
+    };
+
+    struct NodeTiming {
+        int x, y;
+        Component type;
+        int mintime, maxtime; // arrival window
+        int required;
+        int slack;
+    };
+
+    struct TimingPath {
+        int length;
+        QVector<QPoint> points; // first point is the input, last is the output
+    };
+
+    struct TimingReport {
+        TimingStats stats;
+        QVector<NodeTiming> nodes;
+        QVector<NodeTiming> outputs;
+        QVector<TimingPath> paths; // worst first
+        QString toCSV () const;
+        QByteArray toJSON () const;
+    };
+
+    TimingReport buildTimingReport (const TimingSettings &settings, int worstPaths) const;
+
+    // latches are treated as registers: timing is cut at every latch and measured from
+    // one latch's output to the next latch's input.
+    struct RegisterPath {
+        QPoint from, to;
+        int length;
+    };
+
+    struct RegisterReport {
+        int registers;
+        int loops;          // combinational loops left after cutting at latches
+        int worstPath;      // -1 if there are no register to register paths
+        int minCycleTicks;  // worst path plus the latch's own tick
+        QVector<RegisterPath> paths; // worst first, one per destination register
+        RegisterReport () : registers(0), loops(0), worstPath(-1), minCycleTicks(-1) { }
+    };
+
+    RegisterReport buildRegisterReport (int worstPairs) const;
+
     struct AnalysisSettings {
         bool checkTraces;
         bool checkGates;
         bool checkCrosses;
         bool rogueCrosses;
         bool checkLoops;
-        AnalysisSettings () : checkTraces(true), checkGates(true), checkCrosses(true), rogueCrosses(true), checkLoops(true) { }
+        bool checkGlitches;
+        TimingSettings timing;
+        AnalysisSettings () : checkTraces(true), checkGates(true), checkCrosses(true), rogueCrosses(true), checkLoops(true), checkGlitches(false) { }
     };
 
     QStringList analyzeCircuit (const AnalysisSettings &settings) const;
     static QStringList analyzeBlueprint (const AnalysisSettings &settings, const Blueprint *blueprint);
 
+    // the netlist as in the clean graph: gates, plus the traces that aren't just a wire
+    // from one gate to others. entity ids are pixel indices, and pixels has the entity id
+    // of every pixel (row by row), so netlists can be matched up by where things are.
+    struct Netlist {
+        int width, height;
+        QMap<int,Component> entities;
+        QSet<QPair<int,int> > connections; // (from, to)
+        QVector<int> pixels;
+    };
+
+    Netlist netlist () const;
+
 private:
 
     struct SimpleGraph {
@@ -155,6 +294,9 @@ private:
     SimpleGraph compressedConnections () const;
 
     SimpleGraph sgraph_;
+    QVector<int> pixels_;    // entity id of every pixel in a tile with ink, by slot
+    QVector<int> tileSlots_; // slot of every Blueprint::TileSize tile, or -1 if it's empty
+    int entityAt (int x, int y) const; // the pixel index itself in an empty tile
     int bpwidth_;
     int bpheight_;
 
@@ -166,10 +308,12 @@ private:
         Component type;
         Purpose purpose;
         int mintiming, maxtiming;
+        int order; // topological index, see topologicalOrder()
+        bool skip; // zero-delay timing source, see TimingSettings
         bool critpath;
         bool hit;
         bool isloop;
-        Node (int id, Component type) : id(id), type(type), purpose(Other), mintiming(-1), maxtiming(-1), critpath(false), hit(false), isloop(false) { }
+        Node (int id, Component type) : id(id), type(type), purpose(Other), mintiming(-1), maxtiming(-1), order(-1), skip(false), critpath(false), hit(false), isloop(false) { }
         ~Node () {
             for (Node *in : from) in->to.removeOne(this);
             for (Node *out : to) out->from.removeOne(this);
@@ -178,6 +322,22 @@ private:
             from->to.append(to);
             to->from.append(from);
         }
+        // false if the connection to 'to' closes a loop or 'to' is a skipped source
+        bool feeds (const Node *to) const { return !to->skip && order < to->order; }
+        int delay () const { return (IsTrace(type) || skip) ? 0 : 1; }
+        bool source () const { return purpose == Input || skip; }
+        // arrival window of whatever feeds this node (including skipped nodes); false if
+        // nothing timed feeds it.
+        bool inputWindow (int *tmin, int *tmax) const {
+            *tmin = *tmax = -1;
+            for (const Node *f : from) {
+                if (f->maxtiming < 0 || !(skip || f->feeds(this)))
+                    continue;
+                *tmin = (*tmin >= 0 ? std::min(*tmin, f->mintiming + f->delay()) : f->mintiming + f->delay());
+                *tmax = std::max(*tmax, f->maxtiming + f->delay());
+            }
+            return *tmax >= 0;
+        }
     };
 
     using ComplexGraph = QMap<int,Node*>;
@@ -189,7 +349,8 @@ private:
         graph.clear();
     }
 
-    static TimingStats computeTimings (ComplexGraph &graph);
+    static QVector<Node *> topologicalOrder (ComplexGraph &graph);
+    static TimingStats computeTimings (ComplexGraph &graph, const TimingSettings &settings = TimingSettings());
 
 };
 
@@ -0,0 +1,134 @@
+#include "composition.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+#include <algorithm>
+#include <stdexcept>
+
+using std::runtime_error;
+
+namespace Composition {
+
+static QRect partRect (const Part &part) {
+    return QRect(part.offset, QSize(part.blueprint.width(), part.blueprint.height()));
+}
+
+// compares two parts cell by cell where their rectangles meet, a span at a time
+static void findOverlap (const Part &a, const Part &b, Overlap *overlap) {
+
+    const QRect area = partRect(a).intersected(partRect(b));
+    const quint32 empty = Blueprint::RawInk(Blueprint::Empty);
+
+    QVector<uchar> both(area.width()), differ(area.width());
+    int left = area.right() + 1, right = -1, top = area.bottom() + 1, bottom = -1;
+
+    for (int y = area.top(); y <= area.bottom(); ++ y) {
+        std::fill(both.begin(), both.end(), 0);
+        std::fill(differ.begin(), differ.end(), 0);
+        for (Blueprint::Layer layer : { Blueprint::Logic, Blueprint::DecoOn, Blueprint::DecoOff }) {
+            for (int x = area.left(); x <= area.right(); ) {
+                int lengthA, lengthB;
+                const quint32 *inA = a.blueprint.constSpan(layer, x - a.offset.x(), y - a.offset.y(), &lengthA);
+                const quint32 *inB = b.blueprint.constSpan(layer, x - b.offset.x(), y - b.offset.y(), &lengthB);
+                const int length = std::min({ lengthA, lengthB, area.right() + 1 - x });
+                if (inA && inB) {
+                    uchar *bothOut = both.data() + (x - area.left());
+                    uchar *differOut = differ.data() + (x - area.left());
+                    for (int k = 0; k < length; ++ k) {
+                        const bool shared = (inA[k] != empty && inB[k] != empty);
+                        bothOut[k] |= shared;
+                        differOut[k] |= (shared && inA[k] != inB[k]);
+                    }
+                }
+                x += length;
+            }
+        }
+        for (int k = 0; k < area.width(); ++ k) {
+            if (both[k]) {
+                ++ overlap->cells;
+                overlap->conflicts += differ[k];
+                left = std::min(left, area.left() + k);
+                right = std::max(right, area.left() + k);
+                top = std::min(top, y);
+                bottom = std::max(bottom, y);
+            }
+        }
+    }
+
+    if (overlap->cells)
+        overlap->bounds = QRect(QPoint(left, top), QPoint(right, bottom));
+
+}
+
+QVector<Overlap> FindOverlaps (const QVector<Part> &parts) {
+
+    QVector<Overlap> candidates;
+    for (int first = 0; first < parts.size(); ++ first) {
+        for (int second = first + 1; second < parts.size(); ++ second) {
+            if (partRect(parts[first]).intersects(partRect(parts[second]))) {
+                Overlap overlap;
+                overlap.first = first;
+                overlap.second = second;
+                candidates.append(overlap);
+            }
+        }
+    }
+
+    QtConcurrent::blockingMap(candidates, [&] (Overlap &overlap) {
+        findOverlap(parts[overlap.first], parts[overlap.second], &overlap);
+    });
+
+    QVector<Overlap> overlaps;
+    for (const Overlap &overlap : candidates)
+        if (overlap.cells)
+            overlaps.append(overlap);
+    return overlaps;
+
+}
+
+Blueprint Compose (const QVector<Part> &parts, MergePolicy policy, QVector<Overlap> *overlaps) {
+
+    if (parts.isEmpty())
+        throw runtime_error("Nothing to compose.");
+
+    QElapsedTimer timer;
+    timer.start();
+
+    int width = 0, height = 0;
+    for (const Part &part : parts) {
+        if (part.offset.x() < 0 || part.offset.y() < 0)
+            throw runtime_error("Part offsets can't be negative.");
+        width = std::max(width, part.offset.x() + part.blueprint.width());
+        height = std::max(height, part.offset.y() + part.blueprint.height());
+    }
+
+    const QVector<Overlap> found = FindOverlaps(parts);
+    if (overlaps)
+        *overlaps = found;
+    if (policy == RejectConflicts) {
+        for (const Overlap &overlap : found) {
+            if (overlap.conflicts) {
+                throw runtime_error(QString("Parts %1 and %2 put different ink in %3 cells (%4,%5 to %6,%7).")
+                                    .arg(overlap.first + 1).arg(overlap.second + 1).arg(overlap.conflicts)
+                                    .arg(overlap.bounds.left()).arg(overlap.bounds.top())
+                                    .arg(overlap.bounds.right()).arg(overlap.bounds.bottom()).toStdString());
+            }
+        }
+    }
+
+    // the part that wins an overlap is copied last
+    Blueprint result(width, height);
+    for (int k = 0; k < parts.size(); ++ k) {
+        const Part &part = parts[policy == EarlierWins ? parts.size() - 1 - k : k];
+        result.blit(part.blueprint, QRect(0, 0, part.blueprint.width(), part.blueprint.height()),
+                    part.offset.x(), part.offset.y(), Blueprint::AllLayers, true);
+    }
+    result.optimizeStorage();
+
+    qDebug() << "composed" << parts.size() << "parts into" << width << "x" << height << "in" << timer.elapsed() << "ms";
+
+    return result;
+
+}
+
+}
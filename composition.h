@@ -0,0 +1,40 @@
+#ifndef COMPOSITION_H
+#define COMPOSITION_H
+
+#include "blueprint.h"
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+namespace Composition {
+
+// a blueprint and where its top left corner goes in the result
+struct Part {
+    Blueprint blueprint;
+    QPoint offset;
+};
+
+enum MergePolicy { LaterWins=0, EarlierWins=1, RejectConflicts=2 };
+
+// two parts with ink in the same cells
+struct Overlap {
+    int first, second;  // part indices, first < second
+    QRect bounds;       // of the shared cells, in result coordinates
+    int cells;          // cells where both have ink on some layer
+    int conflicts;      // of those, cells where the ink differs
+    Overlap () : first(-1), second(-1), cells(0), conflicts(0) { }
+};
+
+// every pair of parts that has ink in the same cells. pairs are checked in parallel.
+QVector<Overlap> FindOverlaps (const QVector<Part> &parts);
+
+// places the parts into one blueprint just big enough to hold them (offsets can't be
+// negative). empty pixels are transparent; where parts overlap, the merge policy picks
+// whose ink stays, and RejectConflicts throws if two parts put different ink in the same
+// cell. every part is copied with region blits, and overlaps (if not null) gets what
+// FindOverlaps() found.
+Blueprint Compose (const QVector<Part> &parts, MergePolicy policy, QVector<Overlap> *overlaps = nullptr);
+
+}
+
+#endif // COMPOSITION_H
@@ -0,0 +1,363 @@
+#include "diff.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+
+namespace Diff {
+
+// like Blueprint::constSpan(), but anywhere in the diff area: outside the blueprint is
+// an empty span to the end of the row.
+static const quint32 * span (const Blueprint &bp, Blueprint::Layer layer, int x, int y, int width, int *length) {
+    if (y >= bp.height() || x >= bp.width()) {
+        *length = width - x;
+        return nullptr;
+    }
+    return bp.constSpan(layer, x, y, length);
+}
+
+// fills in one row of changes and counts them. the loops over spans are kept simple
+// enough for the compiler to vectorize.
+static void compareRow (const Blueprint &before, const Blueprint &after, int y, int width,
+                        uchar *changes, int counts[5], int *logicChanged, QVector<uchar> &scratch) {
+
+    const quint32 empty = Blueprint::RawInk(Blueprint::Empty);
+
+    std::fill(scratch.begin(), scratch.end(), 0);
+    uchar *inkBefore = scratch.data();
+    uchar *inkAfter = inkBefore + width;
+    uchar *logic = inkAfter + width;
+    uchar *deco = logic + width;
+
+    for (Blueprint::Layer layer : { Blueprint::Logic, Blueprint::DecoOn, Blueprint::DecoOff }) {
+        uchar *differ = (layer == Blueprint::Logic ? logic : deco);
+        for (int x = 0; x < width; ) {
+            int lengthA, lengthB;
+            const quint32 *a = span(before, layer, x, y, width, &lengthA);
+            const quint32 *b = span(after, layer, x, y, width, &lengthB);
+            const int length = std::min({ lengthA, lengthB, width - x });
+            uchar *inA = inkBefore + x, *inB = inkAfter + x, *out = differ + x;
+            if (a && b) {
+                for (int k = 0; k < length; ++ k) {
+                    inA[k] |= (a[k] != empty);
+                    inB[k] |= (b[k] != empty);
+                    out[k] |= (a[k] != b[k]);
+                }
+            } else if (a) {
+                for (int k = 0; k < length; ++ k) {
+                    const uchar ink = (a[k] != empty);
+                    inA[k] |= ink;
+                    out[k] |= ink;
+                }
+            } else if (b) {
+                for (int k = 0; k < length; ++ k) {
+                    const uchar ink = (b[k] != empty);
+                    inB[k] |= ink;
+                    out[k] |= ink;
+                }
+            }
+            x += length;
+        }
+    }
+
+    for (int k = 0; k < width; ++ k) {
+        const uchar change = !(logic[k] | deco[k]) ? Same : !inkBefore[k] ? Added : !inkAfter[k] ? Removed
+                                                   : logic[k] ? Changed : DecoChanged;
+        changes[k] = change;
+        ++ counts[change];
+        *logicChanged += logic[k];
+    }
+
+}
+
+// groups touching changed cells (diagonals too) with a union-find over row runs.
+static QVector<QRect> findRegions (const CellDiff &diff) {
+
+    struct Run { int left, right, label; };
+    QVector<int> parent;
+    QVector<QRect> bounds;
+    QVector<Run> above, here;
+
+    const auto find = [&parent] (int label) {
+        while (parent[label] != label)
+            label = parent[label] = parent[parent[label]];
+        return label;
+    };
+
+    for (int y = 0; y < diff.height; ++ y) {
+        const uchar *row = diff.changes.constData() + y * diff.width;
+        here.clear();
+        for (int x = 0; x < diff.width; ) {
+            // unchanged stretches are skipped 8 cells at a time
+            if (x + 8 <= diff.width) {
+                quint64 block;
+                memcpy(&block, row + x, 8);
+                if (!block) {
+                    x += 8;
+                    continue;
+                }
+            }
+            if (row[x] == Same) {
+                ++ x;
+                continue;
+            }
+            Run run = { x, x, parent.size() };
+            while (run.right + 1 < diff.width && row[run.right + 1] != Same)
+                ++ run.right;
+            parent.append(run.label);
+            bounds.append(QRect(run.left, y, run.right - run.left + 1, 1));
+            here.append(run);
+            x = run.right + 1;
+        }
+        // both run lists are in order, so one pass joins the ones that touch
+        for (int a = 0, h = 0; a < above.size() && h < here.size(); ) {
+            if (above[a].right + 1 >= here[h].left && here[h].right + 1 >= above[a].left) {
+                const int pa = find(above[a].label), ph = find(here[h].label);
+                if (pa != ph)
+                    parent[ph] = pa;
+            }
+            if (above[a].right < here[h].right)
+                ++ a;
+            else
+                ++ h;
+        }
+        std::swap(above, here);
+    }
+
+    QVector<QRect> regions;
+    QHash<int,int> index; // root label => region
+    for (int label = 0; label < parent.size(); ++ label) {
+        const int root = find(label);
+        const int region = index.value(root, -1);
+        if (region < 0) {
+            index.insert(root, regions.size());
+            regions.append(bounds[label]);
+        } else {
+            regions[region] |= bounds[label];
+        }
+    }
+    return regions;
+
+}
+
+CellDiff CompareCells (const Blueprint &before, const Blueprint &after) {
+
+    QElapsedTimer timer;
+    timer.start();
+
+    CellDiff diff;
+    diff.width = std::max(before.width(), after.width());
+    diff.height = std::max(before.height(), after.height());
+    diff.changes = QVector<uchar>(diff.width * diff.height, Same);
+
+    struct Band {
+        int top, bottom;
+        int counts[5];
+        int logic;
+    };
+    QVector<Band> bands;
+    for (int top = 0; top < diff.height; top += Blueprint::TileSize)
+        bands.append(Band{ top, std::min(top + Blueprint::TileSize, diff.height), { 0, 0, 0, 0, 0 }, 0 });
+
+    uchar *changes = diff.changes.data();
+    QtConcurrent::blockingMap(bands, [&] (Band &band) {
+        QVector<uchar> scratch(4 * diff.width);
+        for (int y = band.top; y < band.bottom; ++ y)
+            compareRow(before, after, y, diff.width, changes + y * diff.width, band.counts, &band.logic, scratch);
+    });
+
+    for (const Band &band : bands) {
+        diff.added += band.counts[Added];
+        diff.removed += band.counts[Removed];
+        diff.changed += band.counts[Changed];
+        diff.decoChanged += band.counts[DecoChanged];
+        diff.logicChanged += band.logic;
+    }
+    if (diff.total())
+        diff.regions = findRegions(diff);
+
+    qDebug() << "compared" << diff.width << "x" << diff.height << "cells," << diff.total() << "changed in"
+             << diff.regions.size() << "regions in" << timer.elapsed() << "ms";
+
+    return diff;
+
+}
+
+NetlistDiff CompareNetlists (const Blueprint &before, const Blueprint &after) {
+
+    const Compiler::Netlist a = Compiler(&before).netlist();
+    const Compiler::Netlist b = Compiler(&after).netlist();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // entity ids are pixel indices; number the entities of each netlist from 0
+    struct Side {
+        const Compiler::Netlist &netlist;
+        QVector<int> index;     // entity id => number, or -1
+        QVector<int> ids;       // number => entity id
+        QVector<Compiler::Component> types;
+        QVector<QPoint> first;  // number => first pixel
+        QVector<int> match;     // number => number on the other side, or -1
+    };
+    Side sides[2] = { { a, {}, {}, {}, {}, {} }, { b, {}, {}, {}, {}, {} } };
+    for (Side &side : sides) {
+        side.index = QVector<int>(side.netlist.pixels.size(), -1);
+        for (auto entity = side.netlist.entities.constBegin(); entity != side.netlist.entities.constEnd(); ++ entity) {
+            side.index[entity.key()] = side.ids.size();
+            side.ids.append(entity.key());
+            side.types.append(entity.value());
+        }
+        side.first = QVector<QPoint>(side.ids.size(), QPoint(-1, -1));
+        side.match = QVector<int>(side.ids.size(), -1);
+    }
+    const auto entityAt = [] (const Side &side, int x, int y) {
+        if (x >= side.netlist.width || y >= side.netlist.height)
+            return -1;
+        return side.index[side.netlist.pixels[y * side.netlist.width + x]];
+    };
+    const auto type = [] (const Side &side, int number) {
+        return side.types[number];
+    };
+
+    // count the pixels every pair of gates (or pair of traces) shares. neighbouring pixels
+    // are usually the same pair, so runs are counted before touching the hash.
+    QHash<QPair<int,int>,int> shared;
+    const int width = std::max(a.width, b.width), height = std::max(a.height, b.height);
+    for (int y = 0; y < height; ++ y) {
+        QPair<int,int> run(-1, -1);
+        int length = 0;
+        for (int x = 0; x <= width; ++ x) {
+            QPair<int,int> pair(-1, -1);
+            if (x < width) {
+                for (int s = 0; s < 2; ++ s) {
+                    const int number = entityAt(sides[s], x, y);
+                    if (number >= 0 && sides[s].first[number].x() < 0)
+                        sides[s].first[number] = QPoint(x, y);
+                    (s ? pair.second : pair.first) = number;
+                }
+                if (pair.first < 0 || pair.second < 0 ||
+                        Compiler::IsActive(type(sides[0], pair.first)) != Compiler::IsActive(type(sides[1], pair.second)))
+                    pair = QPair<int,int>(-1, -1);
+            }
+            if (pair != run) {
+                if (run.first >= 0)
+                    shared[run] += length;
+                run = pair;
+                length = 0;
+            }
+            ++ length;
+        }
+    }
+
+    // entities match if they're each other's biggest overlap
+    QVector<QPair<int,int> > bestA(sides[0].ids.size(), { 0, -1 }), bestB(sides[1].ids.size(), { 0, -1 });
+    const auto better = [] (const QPair<int,int> &best, int count, int other) {
+        return count > best.first || (count == best.first && other < best.second);
+    };
+    for (auto pair = shared.constBegin(); pair != shared.constEnd(); ++ pair) {
+        const int ea = pair.key().first, eb = pair.key().second;
+        if (better(bestA[ea], *pair, eb))
+            bestA[ea] = { *pair, eb };
+        if (better(bestB[eb], *pair, ea))
+            bestB[eb] = { *pair, ea };
+    }
+
+    NetlistDiff diff;
+    for (int ea = 0; ea < bestA.size(); ++ ea) {
+        const int eb = bestA[ea].second;
+        if (eb >= 0 && bestB[eb].second == ea) {
+            sides[0].match[ea] = eb;
+            sides[1].match[eb] = ea;
+            ++ diff.matched;
+            if (type(sides[0], ea) != type(sides[1], eb))
+                diff.retyped.append({ Entity{ sides[0].first[ea], type(sides[0], ea) }, Entity{ sides[1].first[eb], type(sides[1], eb) } });
+        }
+    }
+    for (int e = 0; e < sides[0].ids.size(); ++ e)
+        if (sides[0].match[e] < 0)
+            diff.removed.append(Entity{ sides[0].first[e], type(sides[0], e) });
+    for (int e = 0; e < sides[1].ids.size(); ++ e)
+        if (sides[1].match[e] < 0)
+            diff.added.append(Entity{ sides[1].first[e], type(sides[1], e) });
+
+    // connections between matched entities that only one side has
+    for (int s = 0; s < 2; ++ s) {
+        const Side &side = sides[s], &other = sides[1 - s];
+        QVector<Connection> &out = (s ? diff.connected : diff.disconnected);
+        for (const QPair<int,int> &connection : side.netlist.connections) {
+            const int from = side.index[connection.first], to = side.index[connection.second];
+            if (from < 0 || to < 0 || side.match[from] < 0 || side.match[to] < 0)
+                continue;
+            if (!other.netlist.connections.contains({ other.ids[side.match[from]], other.ids[side.match[to]] }))
+                out.append(Connection{ side.first[from], side.first[to] });
+        }
+    }
+
+    // report in reading order
+    const auto readingOrder = [] (const QPoint &p, const QPoint &q) {
+        return p.y() < q.y() || (p.y() == q.y() && p.x() < q.x());
+    };
+    const auto byEntity = [&] (const Entity &p, const Entity &q) { return readingOrder(p.position, q.position); };
+    const auto byConnection = [&] (const Connection &p, const Connection &q) {
+        return readingOrder(p.from, q.from) || (p.from == q.from && readingOrder(p.to, q.to));
+    };
+    std::sort(diff.added.begin(), diff.added.end(), byEntity);
+    std::sort(diff.removed.begin(), diff.removed.end(), byEntity);
+    std::sort(diff.retyped.begin(), diff.retyped.end(), [&] (const QPair<Entity,Entity> &p, const QPair<Entity,Entity> &q) {
+        return byEntity(p.second, q.second);
+    });
+    std::sort(diff.connected.begin(), diff.connected.end(), byConnection);
+    std::sort(diff.disconnected.begin(), diff.disconnected.end(), byConnection);
+
+    qDebug() << "netlist diff:" << diff.matched << "matched," << diff.added.size() << "added," << diff.removed.size()
+             << "removed," << diff.connected.size() + diff.disconnected.size() << "rewired in" << timer.elapsed() << "ms";
+
+    return diff;
+
+}
+
+QImage RenderOverlay (const Blueprint &after, const CellDiff &diff) {
+
+    QImage image(diff.width, diff.height, QImage::Format_RGBA8888);
+    if (image.isNull())
+        return image;
+
+    const quint32 colors[5] = {
+        0,
+        Blueprint::RawInk(QColor(64, 224, 64)),
+        Blueprint::RawInk(QColor(240, 48, 48)),
+        Blueprint::RawInk(QColor(255, 160, 0)),
+        Blueprint::RawInk(QColor(64, 128, 255))
+    };
+
+    for (int y = 0; y < diff.height; ++ y) {
+        quint32 *out = (quint32 *)image.scanLine(y);
+        const uchar *changes = diff.changes.constData() + y * diff.width;
+        // a quarter of the ink over a dark background
+        for (int x = 0; x < diff.width; ) {
+            int length;
+            const quint32 *in = span(after, Blueprint::Logic, x, y, diff.width, &length);
+            length = std::min(length, diff.width - x);
+            uchar *bytes = (uchar *)(out + x);
+            for (int k = 0; k < length; ++ k) {
+                const uchar *ink = (const uchar *)(in ? in + k : &colors[Same]);
+                bytes[4 * k + 0] = 32 + ink[0] / 4;
+                bytes[4 * k + 1] = 32 + ink[1] / 4;
+                bytes[4 * k + 2] = 32 + ink[2] / 4;
+                bytes[4 * k + 3] = 255;
+            }
+            x += length;
+        }
+        for (int x = 0; x < diff.width; ++ x)
+            if (changes[x] != Same)
+                out[x] = colors[changes[x]];
+    }
+
+    return image;
+
+}
+
+}
@@ -0,0 +1,67 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include "blueprint.h"
+#include "compiler.h"
+#include <QImage>
+#include <QPair>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+namespace Diff {
+
+// what happened to a cell, looking at all three layers
+enum Change { Same=0, Added=1, Removed=2, Changed=3, DecoChanged=4 };
+
+// two blueprints compared cell by cell, with their top left corners lined up
+struct CellDiff {
+    int width, height;        // big enough for both
+    int added;                // cells that had no ink on any layer before
+    int removed;              // cells that have no ink on any layer now
+    int changed;              // cells with different logic ink
+    int decoChanged;          // cells where only the deco layers changed
+    int logicChanged;         // cells with different logic ink, whatever else changed
+    QVector<QRect> regions;   // bounds of each group of touching changed cells, top first
+    QVector<uchar> changes;   // a Change per cell, row by row
+    int total () const { return added + removed + changed + decoChanged; }
+    CellDiff () : width(0), height(0), added(0), removed(0), changed(0), decoChanged(0), logicChanged(0) { }
+};
+
+// a gate or trace, at its first pixel (top row, then leftmost)
+struct Entity {
+    QPoint position;
+    Compiler::Component type;
+};
+
+struct Connection {
+    QPoint from, to;
+};
+
+// entities in the two netlists are matched up by the pixels they share, so moving a
+// gate or redrawing part of a trace doesn't make it a different one. connections are
+// only compared between matched entities; the ones that come and go with an added or
+// removed entity aren't listed separately.
+struct NetlistDiff {
+    int matched;
+    QVector<Entity> added, removed;
+    QVector<QPair<Entity,Entity> > retyped; // (before, after)
+    QVector<Connection> connected;          // positions in after
+    QVector<Connection> disconnected;       // positions in before
+    bool isEmpty () const { return added.isEmpty() && removed.isEmpty() && retyped.isEmpty() && connected.isEmpty() && disconnected.isEmpty(); }
+    NetlistDiff () : matched(0) { }
+};
+
+// rows are compared a span at a time on all layers, bands of rows in parallel.
+CellDiff CompareCells (const Blueprint &before, const Blueprint &after);
+
+// compiles both blueprints and compares their netlists.
+NetlistDiff CompareNetlists (const Blueprint &before, const Blueprint &after);
+
+// after's logic layer, faded, with the changes drawn over it: added cells are green,
+// removed red, changed logic orange and deco-only changes blue.
+QImage RenderOverlay (const Blueprint &after, const CellDiff &diff);
+
+}
+
+#endif // DIFF_H
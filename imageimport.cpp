@@ -0,0 +1,417 @@
+#include "imageimport.h"
+#include "circuits.h"
+#include <QCollator>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QImageReader>
+#include <QQueue>
+#include <QStringList>
+#include <QThread>
+#include <QVarLengthArray>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+using std::runtime_error;
+
+namespace ImageImport {
+
+
+QVector<QRgb> Palette (PaletteKind kind) {
+
+    QVector<QRgb> colors;
+
+    switch (kind) {
+    case LogicInks: {
+        const Blueprint::Ink inks[] = {
+            Blueprint::Cross, Blueprint::Tunnel, Blueprint::Mesh,
+            Blueprint::Bus1, Blueprint::Bus2, Blueprint::Bus3, Blueprint::Bus4, Blueprint::Bus5, Blueprint::Bus6,
+            Blueprint::Write, Blueprint::Read,
+            Blueprint::Trace1, Blueprint::Trace2, Blueprint::Trace3, Blueprint::Trace4,
+            Blueprint::Trace5, Blueprint::Trace6, Blueprint::Trace7, Blueprint::Trace8,
+            Blueprint::Trace9, Blueprint::Trace10, Blueprint::Trace11, Blueprint::Trace12,
+            Blueprint::Trace13, Blueprint::Trace14, Blueprint::Trace15, Blueprint::Trace16,
+            Blueprint::Buffer, Blueprint::And, Blueprint::Or, Blueprint::Xor,
+            Blueprint::Not, Blueprint::Nand, Blueprint::Nor, Blueprint::Xnor,
+            Blueprint::LatchOn, Blueprint::LatchOff, Blueprint::Clock, Blueprint::LED,
+            Blueprint::Timer, Blueprint::Random, Blueprint::Break,
+            Blueprint::Wifi0, Blueprint::Wifi1, Blueprint::Wifi2, Blueprint::Wifi3,
+            Blueprint::Annotation, Blueprint::Filler
+        };
+        for (const Blueprint::Ink &ink : inks)
+            colors.append(ink.rgb());
+        break;
+    }
+    case Gray8:
+        for (int g = 0; g <= 255; ++ g)
+            colors.append(qRgb(g, g, g));
+        break;
+    case RGB332: {
+        static const auto rescale = [] (int v, int oldmax, int newmax) {
+            return qRound((float)newmax * (float)v / (float)oldmax);
+        };
+        for (int k = 0; k <= 255; ++ k) {
+            int r = rescale((k >> 5) & 7, 7, 255);
+            int g = rescale((k >> 2) & 7, 7, 255);
+            int b = rescale((k >> 0) & 3, 3, 255);
+            colors.append(qRgb(r, g, b));
+        }
+        break;
+    }
+    case X11: {
+        const char palette[] =
+                "000000, 800000, 008000, 808000, 000080, 800080, 008080, c0c0c0, "
+                "808080, ff0000, 00ff00, ffff00, 0000ff, ff00ff, 00ffff, ffffff, "
+                "000000, 00005f, 000087, 0000af, 0000d7, 0000ff, 005f00, 005f5f, "
+                "005f87, 005faf, 005fd7, 005fff, 008700, 00875f, 008787, 0087af, "
+                "0087d7, 0087ff, 00af00, 00af5f, 00af87, 00afaf, 00afd7, 00afff, "
+                "00d700, 00d75f, 00d787, 00d7af, 00d7d7, 00d7ff, 00ff00, 00ff5f, "
+                "00ff87, 00ffaf, 00ffd7, 00ffff, 5f0000, 5f005f, 5f0087, 5f00af, "
+                "5f00d7, 5f00ff, 5f5f00, 5f5f5f, 5f5f87, 5f5faf, 5f5fd7, 5f5fff, "
+                "5f8700, 5f875f, 5f8787, 5f87af, 5f87d7, 5f87ff, 5faf00, 5faf5f, "
+                "5faf87, 5fafaf, 5fafd7, 5fafff, 5fd700, 5fd75f, 5fd787, 5fd7af, "
+                "5fd7d7, 5fd7ff, 5fff00, 5fff5f, 5fff87, 5fffaf, 5fffd7, 5fffff, "
+                "870000, 87005f, 870087, 8700af, 8700d7, 8700ff, 875f00, 875f5f, "
+                "875f87, 875faf, 875fd7, 875fff, 878700, 87875f, 878787, 8787af, "
+                "8787d7, 8787ff, 87af00, 87af5f, 87af87, 87afaf, 87afd7, 87afff, "
+                "87d700, 87d75f, 87d787, 87d7af, 87d7d7, 87d7ff, 87ff00, 87ff5f, "
+                "87ff87, 87ffaf, 87ffd7, 87ffff, af0000, af005f, af0087, af00af, "
+                "af00d7, af00ff, af5f00, af5f5f, af5f87, af5faf, af5fd7, af5fff, "
+                "af8700, af875f, af8787, af87af, af87d7, af87ff, afaf00, afaf5f, "
+                "afaf87, afafaf, afafd7, afafff, afd700, afd75f, afd787, afd7af, "
+                "afd7d7, afd7ff, afff00, afff5f, afff87, afffaf, afffd7, afffff, "
+                "d70000, d7005f, d70087, d700af, d700d7, d700ff, d75f00, d75f5f, "
+                "d75f87, d75faf, d75fd7, d75fff, d78700, d7875f, d78787, d787af, "
+                "d787d7, d787ff, d7af00, d7af5f, d7af87, d7afaf, d7afd7, d7afff, "
+                "d7d700, d7d75f, d7d787, d7d7af, d7d7d7, d7d7ff, d7ff00, d7ff5f, "
+                "d7ff87, d7ffaf, d7ffd7, d7ffff, ff0000, ff005f, ff0087, ff00af, "
+                "ff00d7, ff00ff, ff5f00, ff5f5f, ff5f87, ff5faf, ff5fd7, ff5fff, "
+                "ff8700, ff875f, ff8787, ff87af, ff87d7, ff87ff, ffaf00, ffaf5f, "
+                "ffaf87, ffafaf, ffafd7, ffafff, ffd700, ffd75f, ffd787, ffd7af, "
+                "ffd7d7, ffd7ff, ffff00, ffff5f, ffff87, ffffaf, ffffd7, ffffff, "
+                "080808, 121212, 1c1c1c, 262626, 303030, 3a3a3a, 444444, 4e4e4e, "
+                "585858, 626262, 6c6c6c, 767676, 808080, 8a8a8a, 949494, 9e9e9e, "
+                "a8a8a8, b2b2b2, bcbcbc, c6c6c6, d0d0d0, dadada, e4e4e4, eeeeee";
+        for (const QString &color : QString(palette).split(", "))
+            colors.append(0xFF000000 | color.toUInt(nullptr, 16));
+        break;
+    }
+    }
+
+    return colors;
+
+}
+
+
+// nearest palette entry search. the palette is kept as separate r, g, b arrays padded
+// to a multiple of 8 entries (far away from every color) so the distance loop has no
+// tail and compiles to simd; the argmin is a second, branch light pass.
+class NearestColor {
+public:
+    explicit NearestColor (const QVector<QRgb> &palette) : count_((palette.size() + 7) & ~7) {
+        r_.fill(Far, count_);
+        g_.fill(Far, count_);
+        b_.fill(Far, count_);
+        for (int k = 0; k < palette.size(); ++ k) {
+            r_[k] = qRed(palette[k]);
+            g_[k] = qGreen(palette[k]);
+            b_[k] = qBlue(palette[k]);
+        }
+    }
+    int find (int r, int g, int b) const {
+        const qint32 *pr = r_.constData(), *pg = g_.constData(), *pb = b_.constData();
+        QVarLengthArray<qint32,256> dist(count_);
+        qint32 *d = dist.data();
+        for (int k = 0; k < count_; ++ k) {
+            const qint32 dr = pr[k] - r, dg = pg[k] - g, db = pb[k] - b;
+            d[k] = dr * dr + dg * dg + db * db;
+        }
+        int best = 0;
+        for (int k = 1; k < count_; ++ k)
+            best = (d[k] < d[best] ? k : best);
+        return best;
+    }
+private:
+    static constexpr qint32 Far = 1000; // 3 * 1000^2 still fits easily
+    int count_;
+    QVector<qint32> r_, g_, b_;
+};
+
+
+// average distance from each palette color to its nearest neighbor, i.e. how far apart
+// the colors are; ordered dithering spreads pixels by about that much.
+static int paletteSpacing (const QVector<QRgb> &palette) {
+    if (palette.size() < 2)
+        return 0;
+    double total = 0;
+    for (int i = 0; i < palette.size(); ++ i) {
+        int nearest = std::numeric_limits<int>::max();
+        for (int j = 0; j < palette.size(); ++ j) {
+            if (i == j || palette[i] == palette[j])
+                continue;
+            const int dr = qRed(palette[i]) - qRed(palette[j]);
+            const int dg = qGreen(palette[i]) - qGreen(palette[j]);
+            const int db = qBlue(palette[i]) - qBlue(palette[j]);
+            nearest = std::min(nearest, dr * dr + dg * dg + db * db);
+        }
+        if (nearest != std::numeric_limits<int>::max())
+            total += std::sqrt((double)nearest);
+    }
+    return qRound(total / palette.size());
+}
+
+
+Blueprint Quantize (QImage image, Blueprint::Layer layer, const QVector<QRgb> &palette, Dither dither) {
+
+    if (palette.isEmpty())
+        throw runtime_error("Palette is empty.");
+    if (layer == Blueprint::Logic)
+        dither = NoDither;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    image = image.convertToFormat(QImage::Format_ARGB32);
+    const int width = image.width();
+    const int height = image.height();
+
+    Blueprint bp(width, height);
+    QVector<quint32 *> lines(height);
+    for (int y = 0; y < height; ++ y)
+        lines[y] = bp.scanLine(layer, y);
+
+    const NearestColor nearest(palette);
+    QVector<quint32> raw(palette.size());
+    for (int k = 0; k < palette.size(); ++ k)
+        raw[k] = Blueprint::RawInk(QColor(palette[k]));
+    const quint32 rawEmpty = Blueprint::RawInk(Blueprint::Empty);
+
+    // 8x8 bayer matrix, 0..63
+    int bayer[8][8];
+    for (int y = 0; y < 8; ++ y) {
+        for (int x = 0; x < 8; ++ x) {
+            int v = 0;
+            for (int bit = 0; bit < 3; ++ bit)
+                v = (v << 2) | ((((x ^ y) >> bit) & 1) << 1) | ((y >> bit) & 1);
+            bayer[y][x] = v;
+        }
+    }
+    const int spread = (dither == Ordered ? paletteSpacing(palette) : 0);
+
+    // floyd-steinberg error flows down the whole image, so it can't be split into bands
+    // without leaving seams; it runs as one band. the others are split up.
+    struct Band {
+        int top, bottom;
+    };
+    const int bandHeight = (dither == FloydSteinberg ? std::max(height, 1) : 64);
+    QVector<Band> bands;
+    for (int top = 0; top < height; top += bandHeight)
+        bands.append(Band{ top, std::min(height, top + bandHeight) });
+
+    QtConcurrent::blockingMap(bands, [&] (Band &band) {
+
+        // small direct mapped cache in front of the search; images repeat colors a lot
+        constexpr int CacheBits = 12;
+        QVector<quint32> cacheKey(1 << CacheBits, 0xFFFFFFFF);
+        QVector<int> cacheValue(1 << CacheBits);
+        const auto lookup = [&] (int r, int g, int b) {
+            const quint32 key = ((quint32)r << 16) | ((quint32)g << 8) | (quint32)b;
+            const quint32 slot = (key * 2654435761u) >> (32 - CacheBits);
+            if (cacheKey[slot] != key) {
+                cacheKey[slot] = key;
+                cacheValue[slot] = nearest.find(r, g, b);
+            }
+            return cacheValue[slot];
+        };
+
+        // floyd-steinberg error for this row and the next, in 16ths, with a pixel of
+        // padding on either side
+        QVector<int> errorRows;
+        int *cur = nullptr, *next = nullptr;
+        if (dither == FloydSteinberg) {
+            errorRows.fill(0, 2 * 3 * (width + 2));
+            cur = errorRows.data();
+            next = cur + 3 * (width + 2);
+        }
+
+        for (int y = band.top; y < band.bottom; ++ y) {
+            const QRgb *src = (const QRgb *)image.constScanLine(y);
+            quint32 *dst = lines[y];
+            if (dither == FloydSteinberg) {
+                std::swap(cur, next);
+                std::fill(next, next + 3 * (width + 2), 0);
+            }
+            for (int x = 0; x < width; ++ x) {
+                const QRgb pixel = src[x];
+                if (qAlpha(pixel) < 128) {
+                    dst[x] = rawEmpty;
+                    continue;
+                }
+                int c[3] = { qRed(pixel), qGreen(pixel), qBlue(pixel) };
+                if (dither == FloydSteinberg) {
+                    for (int ch = 0; ch < 3; ++ ch)
+                        c[ch] = qBound(0, c[ch] + cur[3 * (x + 1) + ch] / 16, 255);
+                } else if (dither == Ordered) {
+                    const int offset = (2 * bayer[y & 7][x & 7] - 63) * spread / 128;
+                    for (int ch = 0; ch < 3; ++ ch)
+                        c[ch] = qBound(0, c[ch] + offset, 255);
+                }
+                const int k = lookup(c[0], c[1], c[2]);
+                dst[x] = raw[k];
+                if (dither == FloydSteinberg) {
+                    const int e[3] = { c[0] - qRed(palette[k]), c[1] - qGreen(palette[k]), c[2] - qBlue(palette[k]) };
+                    for (int ch = 0; ch < 3; ++ ch) {
+                        cur[3 * (x + 2) + ch] += 7 * e[ch];
+                        next[3 * x + ch] += 3 * e[ch];
+                        next[3 * (x + 1) + ch] += 5 * e[ch];
+                        next[3 * (x + 2) + ch] += e[ch];
+                    }
+                }
+            }
+        }
+
+    });
+
+    qDebug() << "quantized" << width << "x" << height << "to" << palette.size() << "colors in" << timer.elapsed() << "ms";
+
+    return bp;
+
+}
+
+
+
+Animation ConvertFrames (QStringList filenames, Blueprint::Layer layer, const QVector<QRgb> &palette, Dither dither, bool packRows) {
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QCollator collator;
+    collator.setNumericMode(true);
+    std::sort(filenames.begin(), filenames.end(), [&collator] (const QString &a, const QString &b) {
+        return collator.compare(a, b) < 0;
+    });
+
+    // frames are hashed as they're read and only distinct ones are kept, until their
+    // conversion on the thread pool is done. a few conversions are allowed in flight so
+    // reading and converting overlap without holding the whole animation in memory.
+    struct Pending {
+        int frame;
+        QFuture<QString> bpString;
+    };
+    QQueue<Pending> pending;
+    const int maxPending = std::max(2, 2 * QThread::idealThreadCount());
+
+    Animation animation;
+    QHash<QByteArray,int> byHash;
+    const auto finishOne = [&] () {
+        Pending done = pending.dequeue();
+        animation.bpStrings[done.frame] = done.bpString.result();
+    };
+
+    for (const QString &filename : filenames) {
+        QImageReader reader(filename);
+        const int count = std::max(1, reader.imageCount());
+        for (int k = 0; k < count; ++ k) {
+            QImage frame = reader.read();
+            if (frame.isNull()) {
+                if (k == 0)
+                    throw runtime_error(QString("Failed to load %1: %2").arg(filename).arg(reader.errorString()).toStdString());
+                break;
+            }
+            frame = frame.convertToFormat(QImage::Format_ARGB32);
+            const int index = animation.original.size();
+
+            if (index == 0)
+                animation.size = frame.size();
+            if (packRows) {
+                if (frame.size() != animation.size)
+                    throw runtime_error("All frames must be the same size for a frame ROM.");
+                if (frame.width() > 64)
+                    throw runtime_error("Frames can't be wider than 64 pixels for a frame ROM.");
+                for (int y = 0; y < frame.height(); ++ y) {
+                    const QRgb *src = (const QRgb *)frame.constScanLine(y);
+                    quint64 word = 0;
+                    for (int x = 0; x < frame.width(); ++ x)
+                        if (qAlpha(src[x]) >= 128 && qGray(src[x]) >= 128)
+                            word |= (1ULL << x);
+                    animation.rows.append(word);
+                }
+            }
+
+            // sha-256 of the size and pixels, so frames can be matched without keeping them
+            QCryptographicHash hash(QCryptographicHash::Sha256);
+            const qint32 dims[2] = { frame.width(), frame.height() };
+            hash.addData((const char *)dims, sizeof(dims));
+            for (int y = 0; y < frame.height(); ++ y)
+                hash.addData((const char *)frame.constScanLine(y), frame.width() * sizeof(QRgb));
+            const QByteArray digest = hash.result();
+
+            animation.bpStrings.append(QString());
+            auto original = byHash.constFind(digest);
+            if (original != byHash.constEnd()) {
+                animation.original.append(original.value());
+                continue;
+            }
+            animation.original.append(index);
+            byHash.insert(digest, index);
+            ++ animation.unique;
+
+            if (pending.size() >= maxPending)
+                finishOne();
+            pending.enqueue(Pending{ index, QtConcurrent::run([frame, layer, palette, dither] () {
+                if (palette.isEmpty())
+                    return Blueprint(frame, layer).bpString();
+                return Quantize(frame, layer, palette, dither).bpString();
+            }) });
+        }
+    }
+
+    while (!pending.isEmpty())
+        finishOne();
+
+    qDebug() << "converted" << animation.original.size() << "frames," << animation.unique << "unique, in" << timer.elapsed() << "ms";
+
+    return animation;
+
+}
+
+
+Blueprint FrameROM (const Animation &animation, int *addressBits, int *rowBits) {
+
+    const int frames = animation.original.size();
+    const QSize size = animation.size;
+    if (frames == 0)
+        throw runtime_error("No frames.");
+    if (animation.rows.size() != frames * size.height())
+        throw runtime_error("Frames weren't packed for a frame ROM.");
+
+    const auto bitsFor = [] (int count) {
+        int bits = 0;
+        while ((1 << bits) < count)
+            ++ bits;
+        return bits;
+    };
+    const int rows = bitsFor(size.height());
+    const int bits = std::max(1, bitsFor(frames) + rows);
+    if (bits > 20)
+        throw runtime_error("Too many frames for a frame ROM.");
+
+    QVector<quint64> data(1 << bits, 0);
+    for (int k = 0; k < frames; ++ k)
+        std::copy_n(animation.rows.constData() + k * size.height(), size.height(), data.begin() + (k << rows));
+
+    if (addressBits)
+        *addressBits = bits;
+    if (rowBits)
+        *rowBits = rows;
+
+    return Circuits::ROM(bits, size.width(), Circuits::Top, Circuits::Near, data, true);
+
+}
+
+}
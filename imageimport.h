@@ -0,0 +1,49 @@
+#ifndef IMAGEIMPORT_H
+#define IMAGEIMPORT_H
+
+#include "blueprint.h"
+#include <QStringList>
+#include <QVector>
+
+namespace ImageImport {
+
+enum PaletteKind { LogicInks=0, Gray8=1, RGB332=2, X11=3 };
+enum Dither { NoDither=0, FloydSteinberg=1, Ordered=2 };
+
+// colors of a built in palette (the logic inks, or the ones on the misc tab), opaque.
+QVector<QRgb> Palette (PaletteKind kind);
+
+// puts an image on a layer with every pixel replaced by the nearest palette color
+// (euclidean rgb); pixels under 50% alpha become empty. the image is processed in row
+// bands in parallel, except with floyd-steinberg, whose error is carried across the whole
+// image in one pass. dithering is ignored on the logic layer, where a mix of inks would
+// just be a broken circuit.
+Blueprint Quantize (QImage image, Blueprint::Layer layer, const QVector<QRgb> &palette, Dither dither);
+
+// blueprints for a sequence of frames
+struct Animation {
+    QVector<int> original;      // for every frame, the first frame with the same content
+    QVector<QString> bpStrings; // for every frame; empty for duplicates of an earlier one
+    int unique;
+    QSize size;                 // of the first frame
+    QVector<quint64> rows;      // with packRows, every frame's 1-bit rows, size.height() per frame
+    Animation () : unique(0) { }
+};
+
+// converts every frame of every file, files in natural name order ("frame2" before
+// "frame10"); animated images (e.g. gif) contribute all of their frames. frames are read
+// one at a time and matched by a hash of their content, and each distinct one is
+// converted once on the thread pool, so only frames still being converted are kept in
+// memory. an empty palette copies pixels as they are, like the single image import.
+// packRows also packs every frame for FrameROM while it's read (bit x is lit where the
+// pixel is at least half opaque and half bright); frames must then all be the same size
+// and at most 64 pixels wide.
+Animation ConvertFrames (QStringList filenames, Blueprint::Layer layer, const QVector<QRgb> &palette, Dither dither, bool packRows = false);
+
+// a rom holding every frame of an animation converted with packRows as a 1-bit frame
+// buffer, one word per row: address is frame << rowBits | row.
+Blueprint FrameROM (const Animation &animation, int *addressBits = nullptr, int *rowBits = nullptr);
+
+}
+
+#endif // IMAGEIMPORT_H
@@ -8,11 +8,16 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonValue>
-#include <QTextStream>
 #include <QDesktopServices>
+#include <QTextStream>
+#include <QtConcurrent>
 #include <stdexcept>
 #include "circuits.h"
 #include "compiler.h"
+#include "composition.h"
+#include "diff.h"
+#include "imageimport.h"
+#include "romdata.h"
 
 using std::runtime_error;
 
@@ -20,9 +25,14 @@ MainWindow::MainWindow(bool debugMode, QWidget *parent)
     : QMainWindow(parent)
     , ui_(new Ui::MainWindow)
     , sedit_(nullptr)
+    , textGeneration_(0)
 {
 
     ui_->setupUi(this);
+    textTimer_.setSingleShot(true);
+    textTimer_.setInterval(150);
+    connect(&textTimer_, &QTimer::timeout, this, &MainWindow::startTextJob);
+    connect(&textWatcher_, &QFutureWatcher<TextResult>::finished, this, &MainWindow::textJobFinished);
     ui_->actStyleEditor->setVisible(debugMode);
     ui_->actStyleEditor->setEnabled(debugMode);
     ui_->lblROMWarning->setText("");
@@ -66,6 +76,11 @@ MainWindow::~MainWindow()
     s.setValue("geometry", geometry());
     s.setValue("top", ui_->actAlwaysOnTop->isChecked());
 
+    // superseded jobs aren't attached to the watcher anymore but still use this, so wait
+    // for all of them, not just the latest.
+    ++ textGeneration_;
+    textPool_.waitForDone();
+
     delete ui_;
 
 }
@@ -79,6 +94,13 @@ Blueprint::Layer MainWindow::selectedConversionLayer () const {
         return Blueprint::Logic;
 }
 
+Compiler::TimingSettings MainWindow::timingSettings () const {
+    Compiler::TimingSettings s;
+    s.skipLatches = ui_->chkSkipLatches->isChecked();
+    s.skipSources = ui_->chkSkipSources->isChecked();
+    return s;
+}
+
 void MainWindow::on_btnConvertImage_clicked()
 {
     try {
@@ -89,7 +111,16 @@ void MainWindow::on_btnConvertImage_clicked()
         if (!bpImage.load(filename))
             throw runtime_error("Failed to load image.");
         Blueprint::Layer layer = selectedConversionLayer();
-        Blueprint bp(bpImage, layer);
+        // palette combo: exact copy, then the ImageImport palettes in order
+        const int palette = ui_->cbConvertPalette->currentIndex();
+        Blueprint bp;
+        if (palette == 0)
+            bp = Blueprint(std::move(bpImage), layer);
+        else
+            bp = ImageImport::Quantize(bpImage, layer, ImageImport::Palette((ImageImport::PaletteKind)(palette - 1)),
+                                       (ImageImport::Dither)ui_->cbConvertDither->currentIndex());
+        if (ui_->chkConvertTrim->isChecked())
+            bp = bp.trimmed();
         ui_->txtConvertedBP->setPlainText(bp.bpString());
     } catch (const std::exception &x) {
         QMessageBox::critical(this, "Error", x.what());
@@ -97,6 +128,53 @@ void MainWindow::on_btnConvertImage_clicked()
 }
 
 
+void MainWindow::on_btnConvertFrames_clicked()
+{
+    try {
+        QStringList filenames = QFileDialog::getOpenFileNames(this, "Load Frames", QString(), "Images (*.png *.gif *.bmp *.jpg *.jpeg);;All Files (*)");
+        if (filenames.isEmpty())
+            return;
+        QString outfile = QFileDialog::getSaveFileName(this, "Save Blueprints", QString(), "Text Files (*.txt);;All Files (*)");
+        if (outfile == "")
+            return;
+
+        const int palette = ui_->cbConvertPalette->currentIndex();
+        const bool frameROM = ui_->chkConvertFramesROM->isChecked();
+        const ImageImport::Animation animation = ImageImport::ConvertFrames(
+                    filenames, selectedConversionLayer(),
+                    palette == 0 ? QVector<QRgb>() : ImageImport::Palette((ImageImport::PaletteKind)(palette - 1)),
+                    (ImageImport::Dither)ui_->cbConvertDither->currentIndex(), frameROM);
+        const int frames = animation.original.size();
+
+        QFile file(outfile);
+        if (!file.open(QFile::WriteOnly | QFile::Text | QFile::Truncate))
+            throw runtime_error(("couldn't write " + outfile + ": " + file.errorString()).toStdString());
+        QTextStream out(&file);
+        out << "# " << frames << " frames, " << animation.unique << " unique\n";
+        for (int k = 0; k < frames; ++ k) {
+            if (animation.original[k] == k)
+                out << "frame " << k << ": " << animation.bpStrings[k] << "\n";
+            else
+                out << "frame " << k << ": same as frame " << animation.original[k] << "\n";
+        }
+
+        if (frameROM) {
+            int addressBits, rowBits;
+            Blueprint rom = ImageImport::FrameROM(animation, &addressBits, &rowBits);
+            out << "# frame rom: " << addressBits << " address bits (frame << " << rowBits << " | row), "
+                << animation.size.width() << " data bits (pixel 0 at the top)\n";
+            out << "rom: " << rom.bpString() << "\n";
+        }
+
+        if (out.status() != QTextStream::Ok || !file.flush())
+            throw runtime_error(("couldn't write " + outfile + ": " + file.errorString()).toStdString());
+
+    } catch (const std::exception &x) {
+        QMessageBox::critical(this, "Error", x.what());
+    }
+}
+
+
 void MainWindow::on_btnConvertBP_clicked()
 {
     try {
@@ -131,156 +209,237 @@ void MainWindow::on_btnLoadROMFile_clicked()
     try {
         ui_->lblROMWarning->setText("");
         QString filename = QFileDialog::getOpenFileName(this, "Load ROM Data File");
-        QFile file(filename);
-        if (!file.open(QFile::ReadOnly))
-            throw runtime_error(file.errorString().toStdString());
+        if (filename == "")
+            return;
+        const ROMData romdata(filename);
         romfile_ = filename;
-        romdata_ = file.readAll();
-        ui_->lblROMFileInfo->setText(QString("%2 (%1 bytes)").arg(romdata_.size()).arg(QFileInfo(file).fileName()));
+        if (romdata.format() == ROMData::Binary)
+            ui_->lblROMFileInfo->setText(QString("%2 (%1 bytes)").arg(romdata.size()).arg(QFileInfo(filename).fileName()));
+        else
+            ui_->lblROMFileInfo->setText(QString("%2 (%3, %1 bytes at 0x%4)").arg(romdata.size()).arg(QFileInfo(filename).fileName())
+                                         .arg(romdata.formatName()).arg(romdata.baseAddress(), 0, 16));
     } catch (const std::exception &x) {
         QMessageBox::critical(this, "Error", x.what());
     }
 }
 
 
-static bool readCSVRow (QTextStream &in, QStringList *row) {
+void MainWindow::on_btnROMGenerate_clicked()
+{
+    try {
+
+        int wordSize = ui_->spnROMWordSize->value();
+        bool bigEndian = (ui_->cbROMByteOrder->currentIndex() == 0);
+        int dataBits = ui_->spnROMDataBits->value();
+        int addrBits = ui_->spnROMAddrBits->value();
+        Circuits::ROMDataLSBSide dataLSB = (Circuits::ROMDataLSBSide)ui_->cbROMDataLSB->currentIndex();
+        Circuits::ROMAddress0Side addr0Side = (Circuits::ROMAddress0Side)ui_->cbAddress0->currentIndex();
+        int skipRows = ui_->spnROMSkipRows->value();
+        bool omitEmpty = ui_->chkROMOmit->isChecked();
+
+        QVector<quint64> data;
 
-    static const int delta[][5] = {
-        //  ,    "   \n    ?  eof
-        {   1,   2,  -1,   0,  -1  }, // 0: parsing (store char)
-        {   1,   2,  -1,   0,  -1  }, // 1: parsing (store column)
-        {   3,   4,   3,   3,  -2  }, // 2: quote entered (no-op)
-        {   3,   4,   3,   3,  -2  }, // 3: parsing inside quotes (store char)
-        {   1,   3,  -1,   0,  -1  }, // 4: quote exited (no-op)
-        // -1: end of row, store column, success
-        // -2: eof inside quotes
-    };
+        if (ui_->chkROMCSV->isChecked()) {
 
-    row->clear();
+            if (romfile_ == "")
+                throw runtime_error("For CSV mode, you must choose an input file.");
 
-    if (in.atEnd())
-        return false;
+            // parsed from a private copy, csv files get rewritten by editors and scripts
+            data = ROMData(romfile_, ROMData::Copied).csvWords(skipRows, 1ULL << addrBits);
 
-    int state = 0, t;
-    char ch;
-    QString cell;
+        } else {
 
-    while (state >= 0) {
+            // the file is read again (and only mapped while generating), so a rebuilt
+            // image is picked up and the file isn't held open in between.
+            if (romfile_ != "") {
+                const ROMData romdata(romfile_);
+                if (romdata.size() > 0)
+                    data = romdata.words(wordSize, bigEndian, 1ULL << addrBits);
+            }
+            if (data.isEmpty())
+                ui_->lblROMWarning->setText("No data file loaded, ROM will be empty.");
 
-        if (in.atEnd())
-            t = 4;
-        else {
-            in >> ch;
-            if (ch == ',') t = 0;
-            else if (ch == '\"') t = 1;
-            else if (ch == '\n') t = 2;
-            else t = 3;
         }
 
-        state = delta[state][t];
-
-        if (state == 0 || state == 3) {
-            cell += ch;
-        } else if (state == -1 || state == 1) {
-            row->append(cell);
-            cell = "";
+        Blueprint bp;
+        if (ui_->chkROMBanked->isChecked()) {
+            Circuits::ROMStats banked;
+            bp = Circuits::BankedROM(addrBits, dataBits, dataLSB, data, ui_->spnROMAspect->value(), &banked);
+            ui_->lblROMWarning->setText(QString("Banked ROM: %1x%2, %3 gates, %4 ticks.")
+                                        .arg(banked.width).arg(banked.height).arg(banked.gates).arg(banked.ticks));
+        } else if (ui_->chkROMMinimize->isChecked()) {
+            Circuits::ROMStats pla, rom;
+            bp = Circuits::PLA(addrBits, dataBits, dataLSB, data, &pla, &rom);
+            ui_->lblROMWarning->setText(QString("PLA: %1 gates, %2x%3, %4 reads, %5 ticks. ROM would be: %6 gates, %7x%8, %9 reads, %10 ticks.")
+                                        .arg(pla.gates).arg(pla.width).arg(pla.height).arg(pla.reads).arg(pla.ticks)
+                                        .arg(rom.gates).arg(rom.width).arg(rom.height).arg(rom.reads).arg(rom.ticks));
+        } else {
+            bp = Circuits::ROM(addrBits, dataBits, dataLSB, addr0Side, data, omitEmpty);
         }
+        if (ui_->chkROMTrim->isChecked())
+            bp = bp.trimmed();
+        ui_->txtROMBP->setPlainText(bp.bpString());
 
+    } catch (const std::exception &x) {
+        QMessageBox::critical(this, "Error", x.what());
     }
+}
+
 
-    if (state == -2)
-        throw runtime_error("End-of-file found while inside quotes.");
+void MainWindow::on_btnRAMGenerate_clicked()
+{
+    try {
 
-    return true;
+        Circuits::RAMStats stats;
+        Blueprint bp = Circuits::RAM(ui_->spnRAMAddrBits->value(), ui_->spnRAMDataBits->value(),
+                                     ui_->spnRAMReadPorts->value(), ui_->spnRAMWritePorts->value(), &stats);
+        ui_->lblRAMInfo->setText(QString("RAM: %1x%2, %3 gates, %4 latches. Read latency %5 ticks, write latency %6 ticks. Self-check passed.")
+                                 .arg(stats.width).arg(stats.height).arg(stats.gates).arg(stats.latches)
+                                 .arg(stats.readTicks).arg(stats.writeTicks));
+        if (ui_->chkRAMTrim->isChecked())
+            bp = bp.trimmed();
+        ui_->txtRAMBP->setPlainText(bp.bpString());
 
+    } catch (const std::exception &x) {
+        ui_->lblRAMInfo->setText("");
+        QMessageBox::critical(this, "Error", x.what());
+    }
 }
 
 
-void MainWindow::on_btnROMGenerate_clicked()
+void MainWindow::on_btnArithGenerate_clicked()
 {
     try {
 
-        int wordSize = ui_->spnROMWordSize->value();
-        bool bigEndian = (ui_->cbROMByteOrder->currentIndex() == 0);
-        int dataBits = ui_->spnROMDataBits->value();
-        int addrBits = ui_->spnROMAddrBits->value();
-        Circuits::ROMDataLSBSide dataLSB = (Circuits::ROMDataLSBSide)ui_->cbROMDataLSB->currentIndex();
-        Circuits::ROMAddress0Side addr0Side = (Circuits::ROMAddress0Side)ui_->cbAddress0->currentIndex();
-        int skipRows = ui_->spnROMSkipRows->value();
-        bool omitEmpty = ui_->chkROMOmit->isChecked();
-
-        QVector<quint64> data;
+        // combo order: 4 adders, incrementer, comparator, 4 shifters
+        const int circuit = ui_->cbArithCircuit->currentIndex();
+        const int bits = ui_->spnArithBits->value();
+        Circuits::ArithmeticStats stats;
+        Blueprint bp;
+        if (circuit < 4)
+            bp = Circuits::Adder(bits, (Circuits::AdderKind)circuit, &stats);
+        else if (circuit == 4)
+            bp = Circuits::Incrementer(bits, &stats);
+        else if (circuit == 5)
+            bp = Circuits::Comparator(bits, &stats);
+        else
+            bp = Circuits::BarrelShifter(bits, (Circuits::ShifterKind)(circuit - 6), &stats);
+        ui_->lblArithInfo->setText(QString("%1: %2x%3, %4 gates. Depth %5 ticks. Self-check passed.")
+                                   .arg(ui_->cbArithCircuit->currentText())
+                                   .arg(stats.width).arg(stats.height).arg(stats.gates).arg(stats.ticks));
+        if (ui_->chkArithTrim->isChecked())
+            bp = bp.trimmed();
+        ui_->txtArithBP->setPlainText(bp.bpString());
 
-        const auto parseInt = [](QString str) {
-            str = str.trimmed().toLower();
-            if (str.startsWith("0x"))
-                return str.mid(2).toInt(nullptr, 16);
-            else if (str.startsWith("0b"))
-                return str.mid(2).toInt(nullptr, 2);
-            else if (str.startsWith("0o"))
-                return str.mid(2).toInt(nullptr, 8);
-            else
-                return str.toInt();
-        };
+    } catch (const std::exception &x) {
+        ui_->lblArithInfo->setText("");
+        QMessageBox::critical(this, "Error", x.what());
+    }
+}
 
-        if (ui_->chkROMCSV->isChecked()) {
 
-            if (romfile_ == "")
-                throw runtime_error("For CSV mode, you must choose an input file.");
+void MainWindow::on_btnComposeGenerate_clicked()
+{
+    try {
 
-            QFile csv(romfile_);
-            csv.open(QFile::ReadOnly | QFile::Text);
-
-            QTextStream in(&csv);
-            QStringList row;
-            while (readCSVRow(in, &row)) {
-                if (skipRows-- > 0)
-                    continue;
-                if (row.empty())
-                    continue;
-                int address = parseInt(row[0]);
-                if (address >= data.size())
-                    data.resize(address + 1, 0);
-                quint64 value = 0;
-                for (int k = 1; k < row.length(); ++ k) {
-                    int bit = (row[k].toInt() ? 1 : 0);
-                    value = (value << 1) | bit;
-                }
-                data[address] = value;
-                qDebug() << address << value;
+        // one part per line: x y blueprint
+        QVector<Composition::Part> parts;
+        const QStringList lines = ui_->txtComposeParts->toPlainText().split('\n');
+        for (int k = 0; k < lines.size(); ++ k) {
+            const QString line = lines[k].simplified();
+            if (line == "")
+                continue;
+            const QStringList fields = line.split(' ');
+            bool okx = false, oky = false;
+            int x = 0, y = 0;
+            if (fields.size() == 3) {
+                x = fields[0].toInt(&okx);
+                y = fields[1].toInt(&oky);
             }
+            if (!okx || !oky)
+                throw runtime_error(QString("Line %1: expected x y blueprint.").arg(k + 1).toStdString());
+            parts.append(Composition::Part{ Blueprint(fields[2]), QPoint(x, y) });
+        }
 
-        } else {
+        QVector<Composition::Overlap> overlaps;
+        Blueprint bp = Composition::Compose(parts, (Composition::MergePolicy)ui_->cbComposeMerge->currentIndex(), &overlaps);
+        QString info = QString("%1 parts, %2x%3.").arg(parts.size()).arg(bp.width()).arg(bp.height());
+        for (int k = 0; k < overlaps.size() && k < 5; ++ k) {
+            const Composition::Overlap &o = overlaps[k];
+            info += QString(" Parts %1 and %2 overlap in %3 cells (%4 different) from %5,%6 to %7,%8.")
+                    .arg(o.first + 1).arg(o.second + 1).arg(o.cells).arg(o.conflicts)
+                    .arg(o.bounds.left()).arg(o.bounds.top()).arg(o.bounds.right()).arg(o.bounds.bottom());
+        }
+        if (overlaps.size() > 5)
+            info += QString(" %1 more overlaps.").arg(overlaps.size() - 5);
+        ui_->lblComposeInfo->setText(info);
+        ui_->txtComposeBP->setPlainText(bp.bpString());
 
-            if (romdata_.isEmpty())
-                ui_->lblROMWarning->setText("No data file loaded, ROM will be empty.");
+    } catch (const std::exception &x) {
+        ui_->lblComposeInfo->setText("");
+        QMessageBox::critical(this, "Error", x.what());
+    }
+}
+
+
+void MainWindow::on_btnDiffCompare_clicked()
+{
+    try {
 
-            const auto getWord = [&] (int offset) {
-                if (offset < 0 || offset >= romdata_.size())
-                    return 0ULL;
-                quint64 word = 0;
-                if (bigEndian) {
-                    for (int k = offset; k < offset + wordSize; ++ k) {
-                        quint8 b = (k < romdata_.size() ? romdata_[k] : 0);
-                        word = (word << 8) | b;
-                    }
-                } else {
-                    for (int k = offset + wordSize - 1; k >= offset; -- k) {
-                        quint8 b = (k < romdata_.size() ? romdata_[k] : 0);
-                        word = (word << 8) | b;
-                    }
-                }
-                return word;
-            };
-
-            for (int j = 0; j < romdata_.size(); j += wordSize)
-                data.append(getWord(j));
+        const Blueprint before(ui_->txtDiffBefore->toPlainText());
+        const Blueprint after(ui_->txtDiffAfter->toPlainText());
+        const Diff::CellDiff cells = Diff::CompareCells(before, after);
 
+        // long lists are cut short, the counts are always complete
+        const int maxLines = 100;
+        QStringList report;
+        const auto more = [&] (int count) {
+            if (count > maxLines)
+                report.append(QString("  ... %1 more").arg(count - maxLines));
+        };
+        const auto at = [] (const QPoint &p) {
+            return QString("%1,%2").arg(p.x()).arg(p.y());
+        };
+
+        report.append(QString("Cells: %1 changed (%2 added, %3 removed, %4 logic changed, %5 deco only) in %6 regions.")
+                      .arg(cells.total()).arg(cells.added).arg(cells.removed).arg(cells.changed)
+                      .arg(cells.decoChanged).arg(cells.regions.size()));
+        for (int k = 0; k < cells.regions.size() && k < maxLines; ++ k) {
+            const QRect &r = cells.regions[k];
+            report.append(QString("  %1 to %2 (%3x%4)").arg(at(r.topLeft())).arg(at(r.bottomRight())).arg(r.width()).arg(r.height()));
+        }
+        more(cells.regions.size());
+
+        // deco doesn't change the circuit, so the netlists only need comparing if the logic changed
+        if (ui_->chkDiffNetlist->isChecked()) {
+            const Diff::NetlistDiff net = cells.logicChanged ? Diff::CompareNetlists(before, after) : Diff::NetlistDiff();
+            report.append("");
+            if (net.isEmpty()) {
+                report.append("Netlist: no changes.");
+            } else {
+                report.append(QString("Netlist: %1 matched, %2 added, %3 removed, %4 changed type, %5 connections added, %6 removed.")
+                              .arg(net.matched).arg(net.added.size()).arg(net.removed.size()).arg(net.retyped.size())
+                              .arg(net.connected.size()).arg(net.disconnected.size()));
+                for (int k = 0; k < net.added.size() && k < maxLines; ++ k)
+                    report.append(QString("  + %1 at %2").arg(Compiler::Desc(net.added[k].type)).arg(at(net.added[k].position)));
+                more(net.added.size());
+                for (int k = 0; k < net.removed.size() && k < maxLines; ++ k)
+                    report.append(QString("  - %1 at %2").arg(Compiler::Desc(net.removed[k].type)).arg(at(net.removed[k].position)));
+                more(net.removed.size());
+                for (int k = 0; k < net.retyped.size() && k < maxLines; ++ k)
+                    report.append(QString("  * %1 at %2 is now %3 at %4").arg(Compiler::Desc(net.retyped[k].first.type)).arg(at(net.retyped[k].first.position))
+                                  .arg(Compiler::Desc(net.retyped[k].second.type)).arg(at(net.retyped[k].second.position)));
+                more(net.retyped.size());
+                for (int k = 0; k < net.connected.size() && k < maxLines; ++ k)
+                    report.append(QString("  + %1 -> %2").arg(at(net.connected[k].from)).arg(at(net.connected[k].to)));
+                more(net.connected.size());
+                for (int k = 0; k < net.disconnected.size() && k < maxLines; ++ k)
+                    report.append(QString("  - %1 -> %2 (old positions)").arg(at(net.disconnected[k].from)).arg(at(net.disconnected[k].to)));
+                more(net.disconnected.size());
+            }
         }
 
-        Blueprint *bp = Circuits::ROM(addrBits, dataBits, dataLSB, addr0Side, data, omitEmpty);
-        ui_->txtROMBP->setPlainText(bp->bpString());
-        delete bp;
+        ui_->txtDiffReport->setPlainText(report.join("\n"));
 
     } catch (const std::exception &x) {
         QMessageBox::critical(this, "Error", x.what());
@@ -288,6 +447,23 @@ void MainWindow::on_btnROMGenerate_clicked()
 }
 
 
+void MainWindow::on_btnDiffSaveImage_clicked()
+{
+    try {
+        const Blueprint before(ui_->txtDiffBefore->toPlainText());
+        const Blueprint after(ui_->txtDiffAfter->toPlainText());
+        const QImage overlay = Diff::RenderOverlay(after, Diff::CompareCells(before, after));
+        QString filename = QFileDialog::getSaveFileName(this, "Save Image");
+        if (filename == "")
+            return;
+        if (!overlay.save(filename))
+            throw runtime_error("Failed to save image.");
+    } catch (const std::exception &x) {
+        QMessageBox::critical(this, "Error", x.what());
+    }
+}
+
+
 void MainWindow::on_chkROMCSV_toggled(bool checked)
 {
     ui_->cbROMByteOrder->setEnabled(ui_->spnROMWordSize->value() > 1 && !checked);
@@ -314,6 +490,12 @@ void MainWindow::on_cbAddress0_activated(int index)
 }
 
 
+void MainWindow::on_chkROMBanked_toggled(bool checked)
+{
+    ui_->spnROMAspect->setEnabled(checked);
+}
+
+
 void MainWindow::on_btnNetlistCheck_clicked()
 {
     try {
@@ -325,6 +507,8 @@ void MainWindow::on_btnNetlistCheck_clicked()
         s.checkCrosses = ui_->chkMissingCrosses->isChecked();
         s.rogueCrosses = ui_->chkExtraCrosses->isChecked();
         s.checkLoops = ui_->chkCheckLoops->isChecked();
+        s.checkGlitches = ui_->chkCheckGlitches->isChecked();
+        s.timing = timingSettings();
         //ui_->txtNetlistOut->setPlainText(c.analyzeCircuit(s).join("\n"));
         QStringList messages = c.analyzeCircuit(s);
         messages += Compiler::analyzeBlueprint(s, &bp);
@@ -352,6 +536,7 @@ void MainWindow::on_btnNetlistGraph_clicked()
         s.scale = ui_->txtPosScale->text().toFloat();
         s.squareio = ui_->chkSquareIO->isChecked();
         s.iecsymbols = ui_->chkIECSymbols->isChecked();
+        s.timing = timingSettings();
         Compiler::GraphResults r = c.buildGraphViz(s);
         ui_->txtNetlistOut->setPlainText(r.graphviz.join("\n"));
         if (r.stats.critpathlen != -1) {
@@ -367,13 +552,113 @@ void MainWindow::on_btnNetlistGraph_clicked()
 }
 
 
+void MainWindow::on_btnNetlistSim_clicked()
+{
+    try {
+        Blueprint bp(ui_->txtNetlistBP->toPlainText());
+        Compiler c(&bp);
+        Compiler::SimSettings settings;
+        settings.clockPeriod = ui_->spnSimClock->value();
+        settings.timerPeriod = ui_->spnSimTimer->value();
+        Compiler::SimResults r = c.buildSimulator(settings);
+        QString filename = QFileDialog::getSaveFileName(this, "Export Simulator", QString(), "C++ Source (*.cpp)");
+        if (filename == "")
+            return;
+        QFile file(filename);
+        if (!file.open(QFile::WriteOnly | QFile::Text))
+            throw runtime_error(file.errorString().toStdString());
+        file.write(r.source.join("\n").toUtf8());
+        ui_->lblGraphStats->setText(QString("simulator: %1 traces, %2 gates, %3 ports").arg(r.traces).arg(r.gates).arg(r.ports));
+    } catch (const std::exception &x) {
+        QMessageBox::critical(this, "Error", x.what());
+    }
+}
+
+
+void MainWindow::on_btnNetlistTiming_clicked()
+{
+    try {
+        Blueprint bp(ui_->txtNetlistBP->toPlainText());
+        Compiler c(&bp);
+        Compiler::TimingReport r = c.buildTimingReport(timingSettings(), ui_->spnTimingPaths->value());
+        QStringList summary;
+        summary.append(QString("critical path: %1 ticks").arg(r.stats.critpathlen));
+        for (const Compiler::NodeTiming &t : r.outputs)
+            summary.append(QString("%1,%2 (%3): arrives %4-%5").arg(t.x).arg(t.y).arg(Compiler::Desc(t.type)).arg(t.mintime).arg(t.maxtime));
+        for (int k = 0; k < r.paths.size(); ++ k) {
+            QStringList points;
+            for (const QPoint &p : r.paths[k].points)
+                points.append(QString("%1,%2").arg(p.x()).arg(p.y()));
+            summary.append(QString("%1) %2 ticks: %3").arg(k + 1).arg(r.paths[k].length).arg(points.join(" -> ")));
+        }
+        ui_->txtNetlistOut->setPlainText(summary.join("\n"));
+        QString filename = QFileDialog::getSaveFileName(this, "Save Timing Report", QString(), "CSV (*.csv);;JSON (*.json)");
+        if (filename == "")
+            return;
+        QFile file(filename);
+        if (!file.open(QFile::WriteOnly | QFile::Text))
+            throw runtime_error(file.errorString().toStdString());
+        if (filename.endsWith(".json", Qt::CaseInsensitive))
+            file.write(r.toJSON());
+        else
+            file.write(r.toCSV().toUtf8());
+    } catch (const std::exception &x) {
+        QMessageBox::critical(this, "Error", x.what());
+    }
+}
+
+
+void MainWindow::on_btnNetlistRegisters_clicked()
+{
+    try {
+        Blueprint bp(ui_->txtNetlistBP->toPlainText());
+        Compiler c(&bp);
+        Compiler::RegisterReport r = c.buildRegisterReport(ui_->spnTimingPaths->value());
+        QStringList summary;
+        summary.append(QString("%1 registers, %2 combinational loop nodes").arg(r.registers).arg(r.loops));
+        if (r.worstPath < 0) {
+            summary.append("no register to register paths");
+        } else {
+            summary.append(QString("worst register to register path: %1 ticks").arg(r.worstPath));
+            summary.append(QString("minimum clock period: %1 ticks per cycle").arg(r.minCycleTicks));
+            for (int k = 0; k < r.paths.size(); ++ k) {
+                const Compiler::RegisterPath &p = r.paths[k];
+                summary.append(QString("%1) %2,%3 -> %4,%5: %6 ticks").arg(k + 1)
+                               .arg(p.from.x()).arg(p.from.y()).arg(p.to.x()).arg(p.to.y()).arg(p.length));
+            }
+        }
+        ui_->txtNetlistOut->setPlainText(summary.join("\n"));
+    } catch (const std::exception &x) {
+        QMessageBox::critical(this, "Error", x.what());
+    }
+}
+
+
 void MainWindow::on_cbTextFont_activated(int)
 {
     doGenerateText();
 }
 
 
-void MainWindow::on_txtTextContent_textChanged(const QString &)
+void MainWindow::on_txtTextContent_textChanged()
+{
+    doGenerateText();
+}
+
+
+void MainWindow::on_spnTextWrap_valueChanged(int)
+{
+    doGenerateText();
+}
+
+
+void MainWindow::on_cbTextAlign_currentIndexChanged(int)
+{
+    doGenerateText();
+}
+
+
+void MainWindow::on_spnTextLineSpacing_valueChanged(int)
 {
     doGenerateText();
 }
@@ -397,6 +682,12 @@ void MainWindow::on_chkTextDecoOff_toggled(bool)
 }
 
 
+void MainWindow::on_chkTextTrim_toggled(bool)
+{
+    doGenerateText();
+}
+
+
 void MainWindow::on_cbTextLogicInk_currentIndexChanged(int)
 {
     doGenerateText();
@@ -416,6 +707,20 @@ void MainWindow::on_clrTextDecoOff_colorChanged(const QColor &)
 
 
 void MainWindow::doGenerateText () {
+
+    // cancels whatever's in flight. system fonts wait for typing to settle first.
+    ++ textGeneration_;
+    if (ui_->btnFontSystem->isChecked()) {
+        textTimer_.start();
+    } else {
+        textTimer_.stop();
+        startTextJob();
+    }
+
+}
+
+
+void MainWindow::startTextJob () {
     try {
 
         static const QMap<int,Blueprint::Ink> LogicInks = {
@@ -424,7 +729,17 @@ void MainWindow::doGenerateText () {
             { 2, Blueprint::LED }
         };
 
-        QString text = ui_->txtTextContent->text();
+        static const QMap<int,Qt::Alignment> Alignments = {
+            { 0, Qt::AlignLeft },
+            { 1, Qt::AlignHCenter },
+            { 2, Qt::AlignRight }
+        };
+
+        const QString text = ui_->txtTextContent->toPlainText();
+        Circuits::TextLayout layout;
+        layout.wrapWidth = ui_->spnTextWrap->value();
+        layout.alignment = Alignments[ui_->cbTextAlign->currentIndex()];
+        layout.lineSpacing = ui_->spnTextLineSpacing->value();
         Blueprint::Ink logicInk, onInk, offInk;
         if (ui_->chkTextLogic->isChecked())
             logicInk = LogicInks[ui_->cbTextLogicInk->currentIndex()];
@@ -433,40 +748,69 @@ void MainWindow::doGenerateText () {
         if (ui_->chkTextDecoOff->isChecked())
             offInk = ui_->clrTextDecoOff->selectedColor();
 
-        Blueprint *bp;
-
-        if (ui_->btnFontBuiltIn->isChecked()) {
-
-            QString fontfile = fonts_[ui_->cbTextFont->currentText()].filename;
-            if (fontfile == "")
-                throw runtime_error("invalid internal font id");
-            QImage fontimage;
-            if (!fontimage.load(fontfile))
-                throw runtime_error(("couldn't load " + fontfile).toStdString());
-            QString charset = fonts_[ui_->cbTextFont->currentText()].charset;
-            int kerning = fonts_[ui_->cbTextFont->currentText()].kerning;
-
-            bp = Circuits::Text(fontimage, charset, kerning, text, logicInk, onInk, offInk);
+        const bool trim = ui_->chkTextTrim->isChecked();
+        const bool builtIn = ui_->btnFontBuiltIn->isChecked();
+        Circuits::BitmapFont glyphs;
+        if (builtIn) {
+            FontDesc &desc = fonts_[ui_->cbTextFont->currentText()];
+            if (desc.glyphs.isNull()) {
+                if (desc.filename == "")
+                    throw runtime_error("invalid internal font id");
+                QImage fontimage;
+                if (!fontimage.load(desc.filename))
+                    throw runtime_error(("couldn't load " + desc.filename).toStdString());
+                desc.glyphs = Circuits::BitmapFont(fontimage, desc.charset, desc.kerning);
+            }
+            glyphs = desc.glyphs;
+        }
+        const QFont font = ui_->cbSystemFont->currentFont();
+        const int height = ui_->spnSystemFontHeight->value();
+
+        // rendering and encoding the blueprint string both happen on the worker. a newer
+        // request bumps the generation, which makes this one give up as soon as it notices.
+        const int generation = ++ textGeneration_;
+        textWatcher_.setFuture(QtConcurrent::run(&textPool_, [=] () {
+            TextResult result;
+            result.generation = generation;
+            const auto cancelled = [this, generation] () { return textGeneration_ != generation; };
+            try {
+                Blueprint bp;
+                if (builtIn)
+                    bp = Circuits::Text(glyphs, text, logicInk, onInk, offInk, layout);
+                else
+                    bp = Circuits::Text(font, height, text, logicInk, onInk, offInk, layout, &systemFontCache_, cancelled);
+                if (trim && !bp.isNull() && !cancelled())
+                    bp = bp.trimmed();
+                if (!bp.isNull() && !cancelled())
+                    result.bpString = bp.bpString();
+            } catch (const std::exception &x) {
+                result.error = x.what();
+            }
+            return result;
+        }));
 
-        } else {
+    } catch (const std::exception &x) {
+        QMessageBox::critical(this, "Error", x.what());
+    }
+}
 
-            QFont font = ui_->cbSystemFont->currentFont();
-            int height = ui_->spnSystemFontHeight->value();
 
-            bp = Circuits::Text(font, height, text, logicInk, onInk, offInk);
+void MainWindow::textJobFinished () {
 
-        }
+    const TextResult result = textWatcher_.result();
+    if (result.generation != textGeneration_)
+        return; // superseded
 
-        ui_->txtTextBP->setPlainText(bp->bpString());
+    if (!result.error.isEmpty()) {
+        QMessageBox::critical(this, "Error", result.error);
+        return;
+    }
 
-        if (ui_->chkTextAutoCopy->isChecked())
-            QGuiApplication::clipboard()->setText(bp->bpString());
+    ui_->txtTextBP->setPlainText(result.bpString);
 
-        delete bp;
+    if (ui_->chkTextAutoCopy->isChecked())
+        QGuiApplication::clipboard()->setText(result.bpString);
 
-    } catch (const std::exception &x) {
-        QMessageBox::critical(this, "Error", x.what());
-    }
 }
 
 void MainWindow::on_actAlwaysOnTop_toggled(bool checked)
@@ -482,67 +826,29 @@ void MainWindow::on_btnROMCSVHelp_clicked()
 }
 
 
+static QString paletteString (ImageImport::PaletteKind kind) {
+    QStringList colors;
+    for (QRgb color : ImageImport::Palette(kind))
+        colors.append(QString::asprintf("%02x%02x%02x", qRed(color), qGreen(color), qBlue(color)));
+    return colors.join(", ");
+}
+
+
 void MainWindow::on_btnMiscGray8_clicked()
 {
-    QStringList colors;
-    for (int g = 0; g <= 255; ++ g)
-        colors.append(QString::asprintf("%02x%02x%02x", g, g, g));
-    ui_->txtMisc->setPlainText(colors.join(", "));
+    ui_->txtMisc->setPlainText(paletteString(ImageImport::Gray8));
 }
 
 
 void MainWindow::on_btnMiscRGB332_clicked()
 {
-    static const auto rescale = [] (int v, int oldmax, int newmax) {
-        return qRound((float)newmax * (float)v / (float)oldmax);
-    };
-    QStringList colors;
-    for (int k = 0; k <= 255; ++ k) {
-        int r = rescale((k >> 5) & 7, 7, 255);
-        int g = rescale((k >> 2) & 7, 7, 255);
-        int b = rescale((k >> 0) & 3, 3, 255);
-        colors.append(QString::asprintf("%02x%02x%02x", r, g, b));
-    }
-    ui_->txtMisc->setPlainText(colors.join(", "));
+    ui_->txtMisc->setPlainText(paletteString(ImageImport::RGB332));
 }
 
 
 void MainWindow::on_btnMiscX11_clicked()
 {
-    const char palette[] =
-            "000000, 800000, 008000, 808000, 000080, 800080, 008080, c0c0c0, "
-            "808080, ff0000, 00ff00, ffff00, 0000ff, ff00ff, 00ffff, ffffff, "
-            "000000, 00005f, 000087, 0000af, 0000d7, 0000ff, 005f00, 005f5f, "
-            "005f87, 005faf, 005fd7, 005fff, 008700, 00875f, 008787, 0087af, "
-            "0087d7, 0087ff, 00af00, 00af5f, 00af87, 00afaf, 00afd7, 00afff, "
-            "00d700, 00d75f, 00d787, 00d7af, 00d7d7, 00d7ff, 00ff00, 00ff5f, "
-            "00ff87, 00ffaf, 00ffd7, 00ffff, 5f0000, 5f005f, 5f0087, 5f00af, "
-            "5f00d7, 5f00ff, 5f5f00, 5f5f5f, 5f5f87, 5f5faf, 5f5fd7, 5f5fff, "
-            "5f8700, 5f875f, 5f8787, 5f87af, 5f87d7, 5f87ff, 5faf00, 5faf5f, "
-            "5faf87, 5fafaf, 5fafd7, 5fafff, 5fd700, 5fd75f, 5fd787, 5fd7af, "
-            "5fd7d7, 5fd7ff, 5fff00, 5fff5f, 5fff87, 5fffaf, 5fffd7, 5fffff, "
-            "870000, 87005f, 870087, 8700af, 8700d7, 8700ff, 875f00, 875f5f, "
-            "875f87, 875faf, 875fd7, 875fff, 878700, 87875f, 878787, 8787af, "
-            "8787d7, 8787ff, 87af00, 87af5f, 87af87, 87afaf, 87afd7, 87afff, "
-            "87d700, 87d75f, 87d787, 87d7af, 87d7d7, 87d7ff, 87ff00, 87ff5f, "
-            "87ff87, 87ffaf, 87ffd7, 87ffff, af0000, af005f, af0087, af00af, "
-            "af00d7, af00ff, af5f00, af5f5f, af5f87, af5faf, af5fd7, af5fff, "
-            "af8700, af875f, af8787, af87af, af87d7, af87ff, afaf00, afaf5f, "
-            "afaf87, afafaf, afafd7, afafff, afd700, afd75f, afd787, afd7af, "
-            "afd7d7, afd7ff, afff00, afff5f, afff87, afffaf, afffd7, afffff, "
-            "d70000, d7005f, d70087, d700af, d700d7, d700ff, d75f00, d75f5f, "
-            "d75f87, d75faf, d75fd7, d75fff, d78700, d7875f, d78787, d787af, "
-            "d787d7, d787ff, d7af00, d7af5f, d7af87, d7afaf, d7afd7, d7afff, "
-            "d7d700, d7d75f, d7d787, d7d7af, d7d7d7, d7d7ff, d7ff00, d7ff5f, "
-            "d7ff87, d7ffaf, d7ffd7, d7ffff, ff0000, ff005f, ff0087, ff00af, "
-            "ff00d7, ff00ff, ff5f00, ff5f5f, ff5f87, ff5faf, ff5fd7, ff5fff, "
-            "ff8700, ff875f, ff8787, ff87af, ff87d7, ff87ff, ffaf00, ffaf5f, "
-            "ffaf87, ffafaf, ffafd7, ffafff, ffd700, ffd75f, ffd787, ffd7af, "
-            "ffd7d7, ffd7ff, ffff00, ffff5f, ffff87, ffffaf, ffffd7, ffffff, "
-            "080808, 121212, 1c1c1c, 262626, 303030, 3a3a3a, 444444, 4e4e4e, "
-            "585858, 626262, 6c6c6c, 767676, 808080, 8a8a8a, 949494, 9e9e9e, "
-            "a8a8a8, b2b2b2, bcbcbc, c6c6c6, d0d0d0, dadada, e4e4e4, eeeeee";
-    ui_->txtMisc->setPlainText(palette);
+    ui_->txtMisc->setPlainText(paletteString(ImageImport::X11));
 }
 
 
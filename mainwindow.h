@@ -2,7 +2,13 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QFutureWatcher>
+#include <QThreadPool>
+#include <QTimer>
+#include <atomic>
 #include "blueprint.h"
+#include "circuits.h"
+#include "compiler.h"
 #include "styleeditordialog.h"
 
 QT_BEGIN_NAMESPACE
@@ -20,17 +26,30 @@ public:
 private slots:
     void on_btnConvertImage_clicked();
     void on_btnConvertBP_clicked();
+    void on_btnConvertFrames_clicked();
     void on_btnLoadROMFile_clicked();
     void on_spnROMWordSize_valueChanged(int arg1);
     void on_spnROMDataBits_valueChanged(int arg1);
     void on_btnROMGenerate_clicked();
+    void on_btnRAMGenerate_clicked();
+    void on_btnArithGenerate_clicked();
+    void on_btnComposeGenerate_clicked();
+    void on_btnDiffCompare_clicked();
+    void on_btnDiffSaveImage_clicked();
     void on_btnNetlistCheck_clicked();
     void on_btnNetlistGraph_clicked();
+    void on_btnNetlistSim_clicked();
+    void on_btnNetlistTiming_clicked();
+    void on_btnNetlistRegisters_clicked();
     void on_cbTextFont_activated(int index);
-    void on_txtTextContent_textChanged(const QString &arg1);
+    void on_txtTextContent_textChanged();
+    void on_spnTextWrap_valueChanged(int);
+    void on_cbTextAlign_currentIndexChanged(int);
+    void on_spnTextLineSpacing_valueChanged(int);
     void on_chkTextLogic_toggled(bool checked);
     void on_chkTextDecoOn_toggled(bool checked);
     void on_chkTextDecoOff_toggled(bool checked);
+    void on_chkTextTrim_toggled(bool checked);
     void on_cbTextLogicInk_currentIndexChanged(int index);
     void on_clrTextDecoOn_colorChanged(const QColor &);
     void on_clrTextDecoOff_colorChanged(const QColor &);
@@ -40,6 +59,7 @@ private slots:
     void on_btnMiscGray8_clicked();
     void on_btnMiscRGB332_clicked();
     void on_cbAddress0_activated(int index);
+    void on_chkROMBanked_toggled(bool checked);
     void on_btnMiscX11_clicked();
     void on_btnConvertEmoji_clicked();
     void on_cbSystemFont_activated(int index);
@@ -52,21 +72,38 @@ private slots:
 
     void on_btnViewGraph_clicked();
 
+    void startTextJob ();
+    void textJobFinished ();
+
 private:
 
+    // output of a text rendering job; generation says which request it belongs to
+    struct TextResult {
+        int generation;
+        QString bpString;
+        QString error;
+        TextResult () : generation(0) { }
+    };
+
     struct FontDesc {
         QString filename;
         QString charset;
         int kerning;
+        Circuits::BitmapFont glyphs; // loaded on first use
         FontDesc () : kerning(0) { }
     };
 
     Ui::MainWindow *ui_;
     StyleEditorDialog *sedit_;
-    QString romfile_;
-    QByteArray romdata_;
+    QString romfile_; // opened again on every generate, so it's never stale
     QMap<QString,FontDesc> fonts_;
+    QTimer textTimer_; // debounces system font rendering
+    QFutureWatcher<TextResult> textWatcher_;
+    QThreadPool textPool_; // every text job, including superseded ones still winding down
+    std::atomic<int> textGeneration_; // bumped by every text request, older jobs give up
+    Circuits::SystemFontCache systemFontCache_;
     Blueprint::Layer selectedConversionLayer () const;
+    Compiler::TimingSettings timingSettings () const;
     void doGenerateText ();
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,601 @@
+#include "romdata.h"
+#include <QFileInfo>
+#include <QtEndian>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using std::runtime_error;
+
+// decoded images bigger than this are almost certainly a file with a few far apart
+// sections (e.g. flash plus ram) rather than something that belongs in a rom.
+static constexpr quint64 MaxImageSize = 64 * 1024 * 1024;
+
+static int hexDigit (uchar ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+static bool isSpace (uchar ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+// decodes a run of hex digit pairs into out; false if there's an odd or invalid digit.
+static bool decodeHexBytes (const uchar *text, qint64 length, QByteArray &out) {
+    if (length % 2)
+        return false;
+    out.resize(length / 2);
+    for (qint64 k = 0; k < length; k += 2) {
+        int hi = hexDigit(text[k]), lo = hexDigit(text[k + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        out[(int)(k / 2)] = (char)((hi << 4) | lo);
+    }
+    return true;
+}
+
+// calls f(line, length, lineNumber) for every non-blank line with surrounding whitespace
+// trimmed; f returns false to stop early.
+template <typename F> static void forEachLine (const uchar *text, qint64 size, F f) {
+    qint64 pos = 0;
+    int number = 0;
+    while (pos < size) {
+        qint64 end = pos;
+        while (end < size && text[end] != '\n')
+            ++ end;
+        ++ number;
+        qint64 first = pos, last = end;
+        while (first < last && isSpace(text[first])) ++ first;
+        while (last > first && isSpace(text[last - 1])) -- last;
+        if (last > first && !f(text + first, last - first, number))
+            return;
+        pos = end + 1;
+    }
+}
+
+static runtime_error recordError (const char *format, int line, const QString &message) {
+    return runtime_error(QString("%1 line %2: %3").arg(format).arg(line).arg(message).toStdString());
+}
+
+
+ROMData::ROMData (const QString &filename, Access access) :
+    file_(filename),
+    map_(nullptr),
+    bytes_(nullptr),
+    size_(0),
+    base_(0),
+    format_(Binary)
+{
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!file_.open(QFile::ReadOnly))
+        throw runtime_error(file_.errorString().toStdString());
+
+    const qint64 fileSize = file_.size();
+    const uchar *contents = nullptr;
+    if (fileSize > 0) {
+        map_ = (access == Mapped ? file_.map(0, fileSize) : nullptr);
+        if (map_) {
+            contents = map_;
+        } else {
+            buffer_ = file_.readAll();
+            contents = (const uchar *)buffer_.constData();
+        }
+    }
+
+    format_ = DetectFormat(filename, contents, fileSize);
+    switch (format_) {
+    case IntelHex: parseIntelHex(contents, fileSize); break;
+    case SRecord: parseSRecord(contents, fileSize); break;
+    case ELF: parseELF(contents, fileSize); break;
+    case Binary:
+        bytes_ = contents;
+        size_ = fileSize;
+        break;
+    }
+
+    // decoded formats don't need the file anymore, and neither does a copy
+    if (format_ != Binary) {
+        if (map_) {
+            file_.unmap(map_);
+            map_ = nullptr;
+        }
+        buffer_.clear();
+    }
+    if (!map_)
+        file_.close();
+
+    qint64 nsecs = timer.nsecsElapsed();
+    qDebug() << "rom data loaded:" << formatName() << size_ << "bytes in" << (double)nsecs / 1000000.0 << "ms";
+
+}
+
+ROMData::~ROMData () {
+    if (map_)
+        file_.unmap(map_);
+}
+
+QString ROMData::formatName () const {
+    switch (format_) {
+    case IntelHex: return "Intel HEX";
+    case SRecord: return "S-record";
+    case ELF: return "ELF";
+    default: return "binary";
+    }
+}
+
+ROMData::Format ROMData::DetectFormat (const QString &filename, const uchar *bytes, qint64 size) {
+
+    if (size >= 4 && bytes[0] == 0x7F && bytes[1] == 'E' && bytes[2] == 'L' && bytes[3] == 'F')
+        return ELF;
+
+    const QString suffix = QFileInfo(filename).suffix().toLower();
+    if (suffix == "hex" || suffix == "ihx" || suffix == "ihex" || suffix == "h86")
+        return IntelHex;
+    if (suffix == "srec" || suffix == "s19" || suffix == "s28" || suffix == "s37" || suffix == "mot" || suffix == "mhx")
+        return SRecord;
+
+    return Binary;
+
+}
+
+void ROMData::AddChunk (QVector<Chunk> &chunks, quint64 address, const uchar *data, int size) {
+    if (!chunks.isEmpty() && chunks.last().address + chunks.last().data.size() == address)
+        chunks.last().data.append((const char *)data, size);
+    else
+        chunks.append(Chunk{ address, QByteArray((const char *)data, size) });
+}
+
+void ROMData::buildImage (const QVector<Chunk> &chunks) {
+
+    image_.clear();
+    base_ = 0;
+    size_ = 0;
+
+    if (chunks.isEmpty()) {
+        bytes_ = nullptr;
+        return;
+    }
+
+    quint64 lo = chunks[0].address, hi = 0;
+    for (const Chunk &chunk : chunks) {
+        lo = std::min(lo, chunk.address);
+        hi = std::max(hi, chunk.address + chunk.data.size());
+    }
+
+    if (hi - lo > MaxImageSize)
+        throw runtime_error(QString("Data spans 0x%1 to 0x%2, which is too big for a ROM.").arg(lo, 0, 16).arg(hi, 0, 16).toStdString());
+
+    // later records win if they overlap, same as a programmer would do
+    image_ = QByteArray((int)(hi - lo), 0);
+    for (const Chunk &chunk : chunks)
+        memcpy(image_.data() + (chunk.address - lo), chunk.data.constData(), chunk.data.size());
+
+    base_ = lo;
+    size_ = image_.size();
+    bytes_ = (const uchar *)image_.constData();
+
+}
+
+void ROMData::parseIntelHex (const uchar *text, qint64 size) {
+
+    QVector<Chunk> chunks;
+    QByteArray record;
+    quint64 upper = 0; // from extended segment/linear address records
+
+    forEachLine(text, size, [&] (const uchar *line, qint64 length, int number) {
+        if (line[0] != ':')
+            throw recordError("Intel HEX", number, "expected ':'.");
+        if (!decodeHexBytes(line + 1, length - 1, record) || record.size() < 5)
+            throw recordError("Intel HEX", number, "invalid record.");
+        const uchar *r = (const uchar *)record.constData();
+        const int count = r[0];
+        if (record.size() != count + 5)
+            throw recordError("Intel HEX", number, "byte count doesn't match record length.");
+        uchar sum = 0;
+        for (int k = 0; k < record.size(); ++ k)
+            sum += r[k];
+        if (sum != 0)
+            throw recordError("Intel HEX", number, "bad checksum.");
+        const quint64 offset = (r[1] << 8) | r[2];
+        if ((r[3] == 0x02 || r[3] == 0x04) && count != 2)
+            throw recordError("Intel HEX", number, "extended address records need 2 bytes.");
+        switch (r[3]) {
+        case 0x00: AddChunk(chunks, upper + offset, r + 4, count); break;
+        case 0x01: return false;
+        case 0x02: upper = (quint64)((r[4] << 8) | r[5]) << 4; break;
+        case 0x04: upper = (quint64)((r[4] << 8) | r[5]) << 16; break;
+        case 0x03: case 0x05: break; // start addresses
+        default: throw recordError("Intel HEX", number, QString("unknown record type %1.").arg(r[3]));
+        }
+        return true;
+    });
+
+    buildImage(chunks);
+
+}
+
+void ROMData::parseSRecord (const uchar *text, qint64 size) {
+
+    QVector<Chunk> chunks;
+    QByteArray record;
+
+    forEachLine(text, size, [&] (const uchar *line, qint64 length, int number) {
+        if (length < 2 || line[0] != 'S' || line[1] < '0' || line[1] > '9')
+            throw recordError("S-record", number, "expected 'S' and a record type.");
+        if (!decodeHexBytes(line + 2, length - 2, record) || record.size() < 2)
+            throw recordError("S-record", number, "invalid record.");
+        const uchar *r = (const uchar *)record.constData();
+        const int count = r[0];
+        if (record.size() != count + 1)
+            throw recordError("S-record", number, "byte count doesn't match record length.");
+        uchar sum = 0;
+        for (int k = 0; k < record.size(); ++ k)
+            sum += r[k];
+        if (sum != 0xFF)
+            throw recordError("S-record", number, "bad checksum.");
+        const int type = line[1] - '0';
+        const int addressSize = (type == 2 || type == 8) ? 3 : (type == 3 || type == 7) ? 4 : 2;
+        if (count < addressSize + 1)
+            throw recordError("S-record", number, "record too short.");
+        quint64 address = 0;
+        for (int k = 0; k < addressSize; ++ k)
+            address = (address << 8) | r[1 + k];
+        switch (type) {
+        case 1: case 2: case 3: AddChunk(chunks, address, r + 1 + addressSize, count - addressSize - 1); break;
+        case 7: case 8: case 9: return false;
+        default: break; // header, counts
+        }
+        return true;
+    });
+
+    buildImage(chunks);
+
+}
+
+void ROMData::parseELF (const uchar *data, qint64 size) {
+
+    if (size < 0x34)
+        throw runtime_error("ELF file is truncated.");
+
+    const bool is64 = (data[4] == 2);
+    const bool bigEndian = (data[5] == 2);
+    if ((data[4] != 1 && data[4] != 2) || (data[5] != 1 && data[5] != 2))
+        throw runtime_error("Unsupported ELF class or byte order.");
+
+    const auto get = [&] (quint64 offset, int bytes) -> quint64 {
+        if (offset > (quint64)size || (quint64)bytes > (quint64)size - offset)
+            throw runtime_error("ELF file is truncated.");
+        switch (bytes) {
+        case 2: return bigEndian ? qFromBigEndian<quint16>(data + offset) : qFromLittleEndian<quint16>(data + offset);
+        case 4: return bigEndian ? qFromBigEndian<quint32>(data + offset) : qFromLittleEndian<quint32>(data + offset);
+        default: return bigEndian ? qFromBigEndian<quint64>(data + offset) : qFromLittleEndian<quint64>(data + offset);
+        }
+    };
+
+    const quint64 phoff = is64 ? get(0x20, 8) : get(0x1C, 4);
+    const quint64 phentsize = get(is64 ? 0x36 : 0x2A, 2);
+    const quint64 phnum = get(is64 ? 0x38 : 0x2C, 2);
+    // both are 16 bits so the product can't overflow, but phoff can be anything
+    if (phoff > (quint64)size || phnum * phentsize > (quint64)size - phoff)
+        throw runtime_error("ELF program headers extend past end of file.");
+
+    // loadable segments, at their physical (load) addresses. bss-like tails (memsz >
+    // filesz) aren't rom contents so they're left out.
+    QVector<Chunk> chunks;
+    for (quint64 k = 0; k < phnum; ++ k) {
+        const quint64 ph = phoff + k * phentsize;
+        if (get(ph, 4) != 1) // PT_LOAD
+            continue;
+        const quint64 offset = is64 ? get(ph + 8, 8) : get(ph + 4, 4);
+        const quint64 paddr = is64 ? get(ph + 24, 8) : get(ph + 12, 4);
+        const quint64 filesz = is64 ? get(ph + 32, 8) : get(ph + 16, 4);
+        if (filesz == 0)
+            continue;
+        if (offset > (quint64)size || filesz > (quint64)size - offset || filesz > MaxImageSize)
+            throw runtime_error("ELF segment extends past end of file.");
+        AddChunk(chunks, paddr, data + offset, (int)filesz);
+    }
+
+    if (chunks.isEmpty())
+        throw runtime_error("ELF file has no loadable segments.");
+
+    buildImage(chunks);
+
+}
+
+template <typename T> static void decodeWords (const uchar *in, quint64 *out, quint64 count, bool bigEndian) {
+    // separate loops so the byte order test isn't in the loop and the swaps vectorize
+    if (bigEndian) {
+        for (quint64 k = 0; k < count; ++ k)
+            out[k] = qFromBigEndian<T>(in + k * sizeof(T));
+    } else {
+        for (quint64 k = 0; k < count; ++ k)
+            out[k] = qFromLittleEndian<T>(in + k * sizeof(T));
+    }
+}
+
+QVector<quint64> ROMData::words (int wordSize, bool bigEndian, quint64 maxWords) const {
+
+    if (wordSize < 1 || wordSize > 8)
+        throw runtime_error("Word size must be 1 to 8 bytes.");
+
+    quint64 count = (size_ + wordSize - 1) / wordSize;
+    if (maxWords && count > maxWords)
+        count = maxWords;
+    const quint64 whole = std::min(count, (quint64)size_ / wordSize);
+
+    QVector<quint64> words(count);
+    quint64 *out = words.data();
+
+    switch (wordSize) {
+    case 1:
+        for (quint64 k = 0; k < whole; ++ k)
+            out[k] = bytes_[k];
+        break;
+    case 2: decodeWords<quint16>(bytes_, out, whole, bigEndian); break;
+    case 4: decodeWords<quint32>(bytes_, out, whole, bigEndian); break;
+    case 8: decodeWords<quint64>(bytes_, out, whole, bigEndian); break;
+    default:
+        break;
+    }
+
+    // odd word sizes, and the zero padded partial word at the end
+    const quint64 first = (wordSize == 1 || wordSize == 2 || wordSize == 4 || wordSize == 8) ? whole : 0;
+    for (quint64 k = first; k < count; ++ k) {
+        const qint64 offset = k * wordSize;
+        quint64 word = 0;
+        for (int b = 0; b < wordSize; ++ b) {
+            const qint64 index = bigEndian ? offset + b : offset + wordSize - 1 - b;
+            word = (word << 8) | (index < size_ ? bytes_[index] : 0);
+        }
+        out[k] = word;
+    }
+
+    return words;
+
+}
+
+bool ROMData::ParseNumber (const char *text, int length, quint64 *value) {
+
+    while (length > 0 && isSpace(text[0])) { ++ text; -- length; }
+    while (length > 0 && isSpace(text[length - 1])) -- length;
+
+    int base = 10;
+    if (length > 2 && text[0] == '0') {
+        switch (text[1]) {
+        case 'x': case 'X': base = 16; break;
+        case 'b': case 'B': base = 2; break;
+        case 'o': case 'O': base = 8; break;
+        }
+        if (base != 10) {
+            text += 2;
+            length -= 2;
+        }
+    }
+
+    if (length <= 0)
+        return false;
+
+    quint64 result = 0;
+    for (int k = 0; k < length; ++ k) {
+        const int digit = hexDigit(text[k]);
+        if (digit < 0 || digit >= base)
+            return false;
+        if (result > (~0ULL - digit) / base)
+            return false;
+        result = result * base + digit;
+    }
+
+    *value = result;
+    return true;
+
+}
+
+namespace {
+
+struct CSVEntry {
+    quint64 address;
+    quint64 value;
+};
+
+// one range of a csv file, starting at the beginning of a row
+struct CSVJob {
+    qint64 begin, end;
+    int maxRows;        // stop after this many rows, -1 = no limit
+    bool store;         // false to just skip rows
+    quint64 maxWords;
+    qint64 next;        // where parsing stopped
+    int rows;
+    QVector<CSVEntry> entries;
+    int errorRow;       // row within this job, -1 if no error
+    QString error;
+    CSVJob () : begin(0), end(0), maxRows(-1), store(true), maxWords(0), next(0), rows(0), errorRow(-1) { }
+};
+
+}
+
+// a bit column: any nonzero integer is a 1. anything that isn't a number counts as 0,
+// like QString::toInt() did.
+static quint64 parseBit (const QByteArray &cell) {
+    const char *c = cell.constData();
+    int length = cell.size();
+    while (length > 0 && isSpace(c[0])) { ++ c; -- length; }
+    while (length > 0 && isSpace(c[length - 1])) -- length;
+    if (length > 0 && (c[0] == '+' || c[0] == '-')) { ++ c; -- length; }
+    if (length == 0)
+        return 0;
+    quint64 bit = 0;
+    for (int k = 0; k < length; ++ k) {
+        if (c[k] < '0' || c[k] > '9')
+            return 0;
+        if (c[k] != '0')
+            bit = 1;
+    }
+    return bit;
+}
+
+// the same state machine the old QTextStream based reader used, but over raw bytes:
+// quoted cells can contain commas and newlines, "" inside quotes is a literal quote.
+// \r\n counts as \n, like a text mode QFile.
+static void parseCSV (const uchar *text, CSVJob &job) {
+
+    static const int delta[][5] = {
+        //  ,    "   \n    ?  eof
+        {   1,   2,  -1,   0,  -1  }, // 0: parsing (store char)
+        {   1,   2,  -1,   0,  -1  }, // 1: parsing (store column)
+        {   3,   4,   3,   3,  -2  }, // 2: quote entered (no-op)
+        {   3,   4,   3,   3,  -2  }, // 3: parsing inside quotes (store char)
+        {   1,   3,  -1,   0,  -1  }, // 4: quote exited (no-op)
+        // -1: end of row, store column, success
+        // -2: eof inside quotes
+    };
+
+    QByteArray cell, addressCell;
+    cell.reserve(64);
+    addressCell.reserve(64);
+
+    qint64 pos = job.begin;
+    while (pos < job.end && job.rows != job.maxRows) {
+
+        int state = 0, column = 0;
+        quint64 value = 0;
+        cell.clear();
+
+        while (state >= 0) {
+
+            int t;
+            uchar ch = 0;
+            if (pos >= job.end) {
+                t = 4;
+            } else {
+                ch = text[pos ++];
+                if (ch == '\r' && pos < job.end && text[pos] == '\n')
+                    continue;
+                if (ch == ',') t = 0;
+                else if (ch == '\"') t = 1;
+                else if (ch == '\n') t = 2;
+                else t = 3;
+            }
+
+            state = delta[state][t];
+
+            if (state == 0 || state == 3) {
+                cell.append((char)ch);
+            } else if (state == -1 || state == 1) {
+                if (column == 0) {
+                    qSwap(addressCell, cell);
+                } else {
+                    value = (value << 1) | parseBit(cell);
+                }
+                cell.clear();
+                ++ column;
+            }
+
+        }
+
+        if (state == -2) {
+            job.errorRow = job.rows;
+            job.error = "End-of-file found while inside quotes.";
+            break;
+        }
+
+        ++ job.rows;
+
+        if (!job.store)
+            continue;
+
+        // blank lines
+        if (column == 1 && addressCell.trimmed().isEmpty())
+            continue;
+
+        quint64 address;
+        if (!ROMData::ParseNumber(addressCell.constData(), addressCell.size(), &address)) {
+            job.errorRow = job.rows - 1;
+            job.error = QString("Invalid address '%1'.").arg(QString::fromUtf8(addressCell));
+            break;
+        }
+
+        if (!job.maxWords || address < job.maxWords)
+            job.entries.append(CSVEntry{ address, value });
+
+    }
+
+    job.next = pos;
+
+}
+
+QVector<quint64> ROMData::csvWords (int skipRows, quint64 maxWords) const {
+
+    if (format_ != Binary)
+        throw runtime_error("CSV files must be plain text.");
+
+    if (size_ == 0)
+        return QVector<quint64>();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // skip header rows first, they could contain quotes
+    CSVJob skip;
+    skip.end = size_;
+    skip.maxRows = skipRows;
+    skip.store = false;
+    parseCSV(bytes_, skip);
+    if (skip.errorRow >= 0)
+        throw runtime_error(QString("CSV row %1: %2").arg(skip.errorRow + 1).arg(skip.error).toStdString());
+
+    // without quotes, every newline ends a row, so big files can be split at newlines
+    // and parsed in parallel.
+    constexpr qint64 MinChunkSize = 1024 * 1024;
+    const qint64 begin = skip.next;
+    const bool quoted = memchr(bytes_ + begin, '\"', size_ - begin) != nullptr;
+    const int chunks = quoted ? 1 : (int)std::max<qint64>(1, std::min<qint64>(QThread::idealThreadCount(), (size_ - begin) / MinChunkSize));
+
+    QVector<CSVJob> jobs(chunks);
+    qint64 pos = begin;
+    for (int k = 0; k < chunks; ++ k) {
+        jobs[k].begin = pos;
+        if (k == chunks - 1) {
+            pos = size_;
+        } else {
+            pos = std::max(pos, begin + (size_ - begin) * (k + 1) / chunks);
+            const uchar *newline = (const uchar *)memchr(bytes_ + pos, '\n', size_ - pos);
+            pos = (newline ? newline - bytes_ + 1 : size_);
+        }
+        jobs[k].end = pos;
+        jobs[k].maxWords = maxWords;
+    }
+
+    QtConcurrent::blockingMap(jobs, [this] (CSVJob &job) { parseCSV(bytes_, job); });
+
+    // later rows win, same as before
+    int rows = skipRows;
+    quint64 size = 0;
+    for (const CSVJob &job : jobs) {
+        if (job.errorRow >= 0)
+            throw runtime_error(QString("CSV row %1: %2").arg(rows + job.errorRow + 1).arg(job.error).toStdString());
+        rows += job.rows;
+        for (const CSVEntry &entry : job.entries)
+            size = std::max(size, entry.address + 1);
+    }
+
+    QVector<quint64> words(size);
+    for (const CSVJob &job : jobs)
+        for (const CSVEntry &entry : job.entries)
+            words[entry.address] = entry.value;
+
+    qint64 nsecs = timer.nsecsElapsed();
+    qDebug() << "csv parsed:" << rows << "rows in" << chunks << "chunks," << (double)nsecs / 1000000.0 << "ms";
+
+    return words;
+
+}
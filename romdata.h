@@ -0,0 +1,74 @@
+#ifndef ROMDATA_H
+#define ROMDATA_H
+
+#include <QFile>
+#include <QByteArray>
+#include <QVector>
+
+// rom contents loaded from a file. raw binaries are memory mapped and read in place;
+// intel hex, motorola s-record and elf files are decoded in a single pass into a flat
+// image that starts at the lowest address they load. a mapped file stays open until
+// the object is destroyed, and the data is only valid while the file isn't rewritten,
+// so don't keep one around: load it when it's needed.
+class ROMData {
+public:
+
+    enum Format { Binary, IntelHex, SRecord, ELF };
+
+    // Copied reads the whole file into memory instead of mapping it and closes it right
+    // away. for text that's likely to be rewritten while it's being parsed (csv).
+    enum Access { Mapped, Copied };
+
+    explicit ROMData (const QString &filename, Access access = Mapped);
+    ~ROMData ();
+
+    Format format () const { return format_; }
+    QString formatName () const;
+    quint64 baseAddress () const { return base_; }
+    qint64 size () const { return size_; }
+    const uchar * bytes () const { return bytes_; }
+
+    // splits the data into words, zero padding a partial word at the end. decodes at
+    // most maxWords words (0 = all of them).
+    QVector<quint64> words (int wordSize, bool bigEndian, quint64 maxWords = 0) const;
+
+    // parses the data as a csv file: the first column is the address (decimal or 0x, 0b,
+    // 0o prefixed), each remaining column is a bit, msb first. addresses at or past
+    // maxWords are ignored (0 = no limit). large files without quotes are parsed in
+    // parallel chunks.
+    QVector<quint64> csvWords (int skipRows, quint64 maxWords = 0) const;
+
+    // parses an unsigned 64-bit decimal, 0x, 0b or 0o number, ignoring surrounding
+    // whitespace. false if it's not a number or doesn't fit.
+    static bool ParseNumber (const char *text, int length, quint64 *value);
+
+    static Format DetectFormat (const QString &filename, const uchar *bytes, qint64 size);
+
+private:
+
+    Q_DISABLE_COPY(ROMData)
+
+    // (address, bytes) runs collected while parsing, merged when contiguous
+    struct Chunk {
+        quint64 address;
+        QByteArray data;
+    };
+
+    QFile file_;
+    uchar *map_;
+    QByteArray buffer_; // file contents, if mapping failed
+    QByteArray image_;  // decoded contents of non-binary formats
+    const uchar *bytes_;
+    qint64 size_;
+    quint64 base_;
+    Format format_;
+
+    static void AddChunk (QVector<Chunk> &chunks, quint64 address, const uchar *data, int size);
+    void buildImage (const QVector<Chunk> &chunks);
+    void parseIntelHex (const uchar *text, qint64 size);
+    void parseSRecord (const uchar *text, qint64 size);
+    void parseELF (const uchar *data, qint64 size);
+
+};
+
+#endif // ROMDATA_H
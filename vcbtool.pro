@@ -2,7 +2,7 @@ QMAKE_TARGET_DESCRIPTION = "VCB Tool"
 VERSION = 1.8.4
 DEFINES += VCBTOOL_VERSION='\\"$$VERSION\\"'
 
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -16,17 +16,25 @@ SOURCES += \
     blueprint.cpp \
     circuits.cpp \
     colorselector.cpp \
+    composition.cpp \
     compiler.cpp \
+    diff.cpp \
+    imageimport.cpp \
     main.cpp \
     mainwindow.cpp \
+    romdata.cpp \
     styleeditordialog.cpp
 
 HEADERS += \
     blueprint.h \
     circuits.h \
     colorselector.h \
+    composition.h \
     compiler.h \
+    diff.h \
+    imageimport.h \
     mainwindow.h \
+    romdata.h \
     styleeditordialog.h
 
 FORMS += \